@@ -0,0 +1,285 @@
+#!/bin/sh
+#
+# Soak test: runs wallfade under Xvfb with llvmpipe, idle = 0, and keeps
+# sending IPC commands while it fades. Memory, GL texture and descriptor
+# counts are sampled from "stats" and must stay flat once warmed up.
+#
+#   ./soak.sh [wallfade binary]
+#
+# SOAK_ROUNDS   IPC commands to send (20000)
+# SOAK_SAMPLE   commands between samples (500)
+# SOAK_IMAGES   directory with wallpapers, generated when unset
+# SOAK_RSS      allowed RSS growth in MiB (32)
+# SOAK_SLACK    allowed growth of texture and descriptor counts (4)
+#
+# A USESANITIZE build also fails the run on LeakSanitizer reports.
+
+set -u
+
+BIN=${1:-./build/wallfade}
+ROUNDS=${SOAK_ROUNDS:-20000}
+SAMPLE=${SOAK_SAMPLE:-500}
+RSS_SLACK=${SOAK_RSS:-32}
+SLACK=${SOAK_SLACK:-4}
+
+BIN=$(readlink -f "$BIN")
+
+if [ ! -x "$BIN" ]; then
+    echo "No wallfade binary at $BIN" >&2
+    exit 1
+fi
+
+for tool in Xvfb; do
+    if ! command -v "$tool" > /dev/null; then
+        echo "$tool is required for the soak test" >&2
+        exit 1
+    fi
+done
+
+WORK=$(mktemp -d)
+XVFB=
+DAEMON=
+
+finish() {
+    [ -n "$DAEMON" ] && kill "$DAEMON" 2> /dev/null
+    [ -n "$XVFB" ] && kill "$XVFB" 2> /dev/null
+    rm -rf "$WORK"
+}
+
+trap finish EXIT
+trap 'exit 1' INT TERM
+
+mkdir -p "$WORK/config" "$WORK/cache" "$WORK/run" "$WORK/images"
+chmod 700 "$WORK/run"
+
+IMAGES=${SOAK_IMAGES:-$WORK/images}
+
+if [ -z "${SOAK_IMAGES:-}" ]; then
+    if command -v gm > /dev/null; then
+        CONVERT="gm convert"
+    elif command -v convert > /dev/null; then
+        CONVERT=convert
+    else
+        echo "Set SOAK_IMAGES, no gm or convert to generate images" >&2
+        exit 1
+    fi
+
+    for colors in red-blue green-black white-purple yellow-navy orange-teal; do
+        $CONVERT -size 1600x900 "gradient:$colors" "$IMAGES/$colors.jpg"
+        $CONVERT -size 800x1200 "gradient:$colors" "$IMAGES/$colors.png"
+    done
+fi
+
+FIRST=$(ls "$IMAGES"/* | head -n 1)
+
+# Files that cannot be decoded or opened, for the error paths.
+mkdir -p "$WORK/broken"
+echo "not an image" > "$WORK/broken/garbage.jpg"
+head -c 4096 "$FIRST" > "$WORK/broken/truncated.jpg"
+echo "not readable" > "$WORK/broken/unreadable.jpg"
+chmod 000 "$WORK/broken/unreadable.jpg"
+
+# The slideshow meets them too when the images are ours.
+if [ -z "${SOAK_IMAGES:-}" ]; then
+    cp "$WORK/broken/garbage.jpg" "$WORK/broken/truncated.jpg" "$IMAGES"
+fi
+
+FILES=$(ls "$IMAGES"/* "$WORK"/broken/*; echo "$WORK/missing.jpg")
+NFILES=$(printf '%s\n' "$FILES" | wc -l)
+SIZES="32 48 64 96 128"
+
+cat > "$WORK/config/wallfade.ini" << EOF
+[SETTINGS]
+idle = 0
+fade = 0.05
+vram = 32
+preload = 2
+
+[PATHS]
+default = "$IMAGES/*"
+EOF
+
+export XDG_CONFIG_HOME="$WORK/config"
+export XDG_CACHE_HOME="$WORK/cache"
+export XDG_RUNTIME_DIR="$WORK/run"
+export LIBGL_ALWAYS_SOFTWARE=1
+export GALLIUM_DRIVER=llvmpipe
+
+# Mesa, X and Magick keep a few allocations until exit, those are not ours.
+cat > "$WORK/lsan.supp" << EOF
+leak:libGLX
+leak:libGL.so
+leak:libgallium
+leak:dri.so
+leak:libLLVM
+leak:libX11
+leak:libxcb
+leak:libMagick
+leak:libGraphicsMagick
+leak:libfontconfig
+EOF
+
+export ASAN_OPTIONS="detect_leaks=1:exitcode=23"
+export LSAN_OPTIONS="suppressions=$WORK/lsan.supp:print_suppressions=0"
+
+DISPLAY_NUM=99
+
+while [ -e "/tmp/.X$DISPLAY_NUM-lock" ]; do
+    DISPLAY_NUM=$((DISPLAY_NUM + 1))
+done
+
+export DISPLAY=":$DISPLAY_NUM"
+
+Xvfb "$DISPLAY" -screen 0 1920x1080x24 +extension GLX +extension RANDR \
+    -nolisten tcp > "$WORK/xvfb.log" 2>&1 &
+XVFB=$!
+
+tries=0
+
+until [ -e "/tmp/.X11-unix/X$DISPLAY_NUM" ]; do
+    tries=$((tries + 1))
+
+    if [ $tries -gt 100 ] || ! kill -0 "$XVFB" 2> /dev/null; then
+        echo "Xvfb did not come up:" >&2
+        cat "$WORK/xvfb.log" >&2
+        exit 1
+    fi
+
+    sleep 0.1
+done
+
+"$BIN" > "$WORK/wallfade.log" 2>&1 &
+DAEMON=$!
+
+message() {
+    "$BIN" -m "$1" 2> /dev/null
+}
+
+tries=0
+
+until message current | grep -q "Monitor 0"; do
+    tries=$((tries + 1))
+
+    if [ $tries -gt 100 ] || ! kill -0 "$DAEMON" 2> /dev/null; then
+        echo "wallfade did not come up:" >&2
+        cat "$WORK/wallfade.log" >&2
+        exit 1
+    fi
+
+    sleep 0.1
+done
+
+# Prints the file for turn $1, cycling through all of FILES.
+pick() {
+    printf '%s\n' "$FILES" | sed -n "$(($1 % NFILES + 1))p"
+}
+
+# Prints the thumbnail size for turn $1, so most requests miss the cache.
+size() {
+    set -- $(($1 % 5 + 1)) $SIZES
+    shift "$1"
+    echo "$1"
+}
+
+# Prints "<rss kB> <textures> <descriptors>" of the running daemon.
+sample() {
+    rss=$(awk '/^VmRSS/ { print $2 }' "/proc/$DAEMON/status")
+    message stats | awk -v rss="$rss" '
+        /^Objects:/ { textures = $2; fds = $5 }
+        END { print rss, textures, fds }
+    '
+}
+
+COMMANDS="next current stats config previous goto queue preload thumbnail order"
+WARMUP=$((ROUNDS / 4))
+round=0
+turn=0
+next_sample=$SAMPLE
+base_rss=0
+base_tex=0
+base_fds=0
+peak_rss=0
+peak_tex=0
+peak_fds=0
+
+while [ $round -lt "$ROUNDS" ]; do
+    file=$(pick $turn)
+
+    for command in $COMMANDS; do
+        case $command in
+            goto) message "goto \"$file\"" ;;
+            queue) message "queue 0 \"$file\" \"$(pick $((turn + 1)))\"" ;;
+            thumbnail) message "thumbnail \"$file\" $(size $turn)" ;;
+            order) message "order random" ;;
+            *) message "$command" ;;
+        esac > /dev/null
+
+        round=$((round + 1))
+    done
+
+    turn=$((turn + 1))
+
+    if ! kill -0 "$DAEMON" 2> /dev/null; then
+        echo "wallfade died after $round commands:" >&2
+        tail -n 50 "$WORK/wallfade.log" >&2
+        exit 1
+    fi
+
+    if [ $round -lt $next_sample ]; then
+        continue
+    fi
+
+    next_sample=$((next_sample + SAMPLE))
+
+    set -- $(sample)
+
+    if [ $# -ne 3 ]; then
+        echo "No stats from wallfade after $round commands" >&2
+        exit 1
+    fi
+
+    echo "soak: $round commands, RSS $(($1 / 1024)) MiB, $2 textures, $3 fds"
+
+    # The first quarter fills caches and pools, that is the baseline.
+    if [ $round -le $WARMUP ]; then
+        [ "$1" -gt $base_rss ] && base_rss=$1
+        [ "$2" -gt $base_tex ] && base_tex=$2
+        [ "$3" -gt $base_fds ] && base_fds=$3
+    else
+        [ "$1" -gt $peak_rss ] && peak_rss=$1
+        [ "$2" -gt $peak_tex ] && peak_tex=$2
+        [ "$3" -gt $peak_fds ] && peak_fds=$3
+    fi
+done
+
+failed=0
+
+if [ $peak_rss -gt $((base_rss + RSS_SLACK * 1024)) ]; then
+    echo "RSS grew from $((base_rss / 1024)) to $((peak_rss / 1024)) MiB" >&2
+    failed=1
+fi
+
+if [ $peak_tex -gt $((base_tex + SLACK)) ]; then
+    echo "GL textures grew from $base_tex to $peak_tex" >&2
+    failed=1
+fi
+
+if [ $peak_fds -gt $((base_fds + SLACK)) ]; then
+    echo "File descriptors grew from $base_fds to $peak_fds" >&2
+    failed=1
+fi
+
+kill -TERM "$DAEMON"
+wait "$DAEMON"
+status=$?
+DAEMON=
+
+if [ $status -ne 0 ]; then
+    echo "wallfade exited with $status:" >&2
+    tail -n 50 "$WORK/wallfade.log" >&2
+    failed=1
+fi
+
+[ $failed -eq 0 ] && echo "soak: passed"
+
+exit $failed
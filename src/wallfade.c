@@ -1,10 +1,12 @@
+#define _GNU_SOURCE
+
 #include <GL/gl.h>                  // for glColor4f, glTexCoord2f, glVertex2i
 #include <GL/glx.h>                 // for glXChooseVisual, glXCreateContext
 #include <X11/X.h>                  // for None, Window
 #include <X11/Xatom.h>              // for XA_ATOM
 #include <X11/Xlib.h>               // for Screen, (anonymous), XOpenDisplay
 #include <X11/Xutil.h>              // for XVisualInfo
-#include <dirent.h>                 // for DIR, opendir, closedir, readdir
+#include <fcntl.h>                  // for open, O_CREAT
 #include <getopt.h>                 // for optarg, getopt
 #include <glob.h>                   // for glob_t, glob, globfree, GLOB_BRACE
 #include <limits.h>                 // for PATH_MAX
@@ -14,58 +16,382 @@
 #include <stdio.h>                  // for fprintf, NULL, printf, stderr
 #include <stdlib.h>                 // for exit, free, malloc, rand, realpath
 #include <string.h>                 // for __s1_len, __s2_len, strcmp, strlen
+#include <strings.h>                // for strcasecmp
 #include <sys/time.h>               // for CLOCK_MONOTONIC
 #include <tgmath.h>                 // for fmaxf, fminf
 #include <time.h>                   // for timespec, clock_gettime, time
-#include <unistd.h>                 // for usleep
+#include <unistd.h>                 // for close, getcwd, read
 #include <ctype.h>                  // for isdigit
 #include <libgen.h>
+#include <dirent.h>
 
 #include <X11/extensions/Xrandr.h>  // for XRRMonitorInfo, XRRFreeMonitors
 #include <X11/extensions/Xinerama.h>
+#include <X11/extensions/dpms.h>
+#include <X11/extensions/scrnsaver.h>
 
 #include <iniparser.h>
 
+#include <pthread.h>
 #include <pwd.h>
-#include <sys/shm.h>
+#include <errno.h>
+#include <malloc.h>
+#include <sys/epoll.h>
+#include <sys/file.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <stdatomic.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/un.h>
 
 #include "magick.h"
 
-#define MEM_SIZE 4096
+#ifdef HAVE_JPEG
+#include <setjmp.h>
+#include <jpeglib.h>
+#endif
+
+#ifdef HAVE_PNG
+#include <png.h>
+#endif
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#define MAX_MESSAGE 65536
+#define SOCKET_PATH_MAX sizeof(((struct sockaddr_un *)0)->sun_path)
 
-#define MAX_MONITORS 10
 #define DEFAULT_IDLE_TIME 3
 #define DEFAULT_FADE_TIME 1
-
-#define S_(x) #x
-#define S(x) S_(x)
+#define POWER_CHECK_TIME 1.0f
+#define DEFAULT_VRAM 256
+#define DEFAULT_STREAM 24
+#define DEFAULT_PREFETCH_TIMEOUT 5
+#define PREFETCH_QUEUE 16
+#define PREFETCH_CHUNK (1 << 20)
+#define PREFETCH_RETRY 60
+#define THUMB_MAX 1024
+
+#define IOPRIO_WHO_PROCESS 1
+#define IOPRIO_CLASS_IDLE 3
+#define IOPRIO_CLASS_SHIFT 13
+#define HISTORY_SIZE 16
+#define ANIM_RING 3
+#define ANIM_CHUNK 8
+#define ANIM_DEFAULT_DELAY 0.1f
+
+#define GLOB_SUFFIX "*.{jpg,png,gif,webp}"
+#define DISK_MAGIC "WFC1"
+#define SHARED_MAGIC 0x57465348
+#define SHARED_SLOTS 1024
+#define SHARED_PROBE 16
+
+#define COMPRESS_NONE 0
+#define COMPRESS_RGB565 1
+#define COMPRESS_BC1 2
+
+#define ORDER_RANDOM 0
+#define ORDER_SEQUENTIAL 1
+#define ORDER_SORTED 2
+#define ORDER_SHUFFLE 3
+
+#define SCAN_RUNNING 0
+#define SCAN_DONE 1
+#define SCAN_ABANDONED 2
+
+// Settings given on the command line or over IPC survive a config reload.
+#define OVERRIDE_FADE (1 << 0)
+#define OVERRIDE_IDLE (1 << 1)
+#define OVERRIDE_SMOOTH (1 << 2)
+#define OVERRIDE_CENTER (1 << 3)
+#define OVERRIDE_SPAN (1 << 4)
+#define OVERRIDE_BEZEL (1 << 5)
+#define OVERRIDE_ORDER (1 << 6)
+#define OVERRIDE_LOWER (1 << 7)
+#define OVERRIDE_PATHS (1 << 8)
+#define OVERRIDE_MIRROR (1 << 9)
 
 #define MESSAGE(y,x) !strcmp(y, x)
+#define MIN(a,b) ((a) < (b) ? (a) : (b))
+#define MAX(a,b) ((a) > (b) ? (a) : (b))
 
-#define MSG_NONE '\0'
-#define MSG_PARENT '\1'
-#define MSG_DONE '\2'
 
 struct Path {
     char path[PATH_MAX];
 };
 
+struct IndexEntry {
+    char *path;
+    time_t mtime;
+    bool failed;
+};
+
+struct IndexScan {
+    pthread_t thread;
+    _Atomic int state;
+    bool lower;
+
+    char pattern[PATH_MAX];
+    struct timespec mtime;
+    int order;
+
+    char **paths;
+    size_t count;
+    struct IndexEntry *entries;
+    int nfiles;
+};
+
+struct Index {
+    char pattern[PATH_MAX];
+    struct timespec mtime;
+
+    struct IndexEntry *entries;
+    int nfiles;
+    int nfailed;
+
+    int pos;
+    int *shuffle;
+
+    // A rescan in flight, the entries above are served until it is done.
+    struct IndexScan *scan;
+};
+
+struct Playlist {
+    char (*entries)[PATH_MAX];
+    int count;
+    int queued;
+
+    // Whether the last pick came from the explicit queue.
+    bool picked;
+};
+
+struct CacheEntry {
+    uint32_t texture;
+    size_t bytes;
+    uint64_t used;
+
+    char path[PATH_MAX];
+};
+
+struct Animation {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+
+    bool running;
+    bool shown;
+    bool done;
+
+    int width;
+    int height;
+    float fps;
+
+    unsigned char *frames[ANIM_RING];
+    float delays[ANIM_RING];
+    int head;
+    int count;
+
+    uint32_t textures[2];
+    int current;
+
+    float elapsed;
+    float delay;
+
+    char path[PATH_MAX];
+};
+
 struct Plane {
     int width;
     int height;
     int x;
     int y;
 
+    int span_x;
+    int span_y;
+
     uint32_t front;
     uint32_t back;
 
     char front_path[PATH_MAX];
     char back_path[PATH_MAX];
+
+    struct CacheEntry *cache;
+    int ncache;
+
+    char (*history)[PATH_MAX];
+    int nhistory;
+
+    struct Animation *anim;
+
+    bool pending;
+    bool failed;
+    bool covered;
+    int head;
+
+    char saved_path[PATH_MAX];
+};
+
+struct Head {
+    int screen;
+    Screen *scr;
+    XVisualInfo *vi;
+    Window root;
+    Window desktop;
+    Window win;
+    GLXContext ctx;
+
+    bool obscured;
+};
+
+struct Client {
+    int fd;
+    bool done;
+
+    char *in;
+    size_t in_len;
+
+    char *out;
+    size_t out_len;
+    size_t out_pos;
+    size_t out_size;
+
+    bool subscribed;
+    int thumbs;
+    bool closed;
+
+    struct Client *next;
 };
 
 struct OpenGL {
     GLXContext ctx;
+
+    // Framebuffer objects for resizing on the GPU, see gpuInit.
+    bool probed;
+    bool fbo;
+    int max_texture;
+
+    // Texture storage picked at start-up, see compressName.
+    int format;
+
+    PFNGLGENFRAMEBUFFERSPROC genFramebuffers;
+    PFNGLBINDFRAMEBUFFERPROC bindFramebuffer;
+    PFNGLFRAMEBUFFERTEXTURE2DPROC framebufferTexture2D;
+    PFNGLCHECKFRAMEBUFFERSTATUSPROC checkFramebufferStatus;
+    PFNGLDELETEFRAMEBUFFERSPROC deleteFramebuffers;
+    PFNGLGENERATEMIPMAPPROC generateMipmap;
+};
+
+struct Prefetch {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+
+    char queue[PREFETCH_QUEUE][PATH_MAX];
+    int head;
+    int count;
+
+    char current[PATH_MAX];
+    struct timespec since;
+
+    char stalled[PREFETCH_QUEUE][PATH_MAX];
+    struct timespec stalled_at[PREFETCH_QUEUE];
+    int nstalled;
+
+    double rate;
+    double timeout;
+};
+
+struct Snapshot {
+    char file[PATH_MAX];
+    char path[PATH_MAX];
+    int width;
+    int height;
+    unsigned char *data;
+
+    struct Snapshot *next;
+};
+
+struct DecodeJob {
+    int id;
+    int monitor;
+    bool back;
+    int state;
+
+    int width;
+    int height;
+    char path[PATH_MAX];
+
+    bool gpu;
+    bool refine;
+    bool drafted;
+    struct timespec pushed;
+    int src_width;
+    int src_height;
+    unsigned char *draft;
+    unsigned char *data;
+
+    // Thumbnails go to the disk cache and are answered to the client.
+    struct Client *client;
+    bool thumb;
+    bool written;
+};
+
+struct Decoder {
+    pthread_t *threads;
+    int nthreads;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    bool running;
+
+    struct DecodeJob *jobs;
+    int njobs;
+    int serial;
+
+    double spent;
+    double budget;
+};
+
+struct SharedSlot {
+    _Atomic uint64_t key;
+    _Atomic uint32_t ready;
+    uint32_t width;
+    uint32_t height;
+    uint64_t offset;
+};
+
+struct SharedHeader {
+    uint32_t magic;
+    uint64_t size;
+    _Atomic uint64_t top;
+    struct SharedSlot slots[SHARED_SLOTS];
+};
+
+struct Precache {
+    const char *path;
+    int width;
+    int height;
+};
+
+struct Stream {
+    int x;
+    int y;
+    int width;
+    int height;
+
+    int out_width;
+    int out_height;
+
+    int *columns;
+    uint64_t *acc;
+    int band;
+    int row;
+
+    unsigned char *line;
+    unsigned char *data;
 };
 
 struct _settings {
@@ -75,9 +401,18 @@ struct _settings {
     Window root;
     Window desktop;
     Window win;
+    Window lower_win;
+    Atom client_list;
+    Atom wm_state;
+    Atom wm_fullscreen;
+    int nfullscreen;
+
+    struct Head *heads;
+    int nheads;
+    int head;
 
     int base;
-    int parent;
+    int lock;
 
     float seconds;
     float timer;
@@ -87,55 +422,315 @@ struct _settings {
     int nmon;
     int *nfiles;
 
+    struct Index *index;
+    struct Playlist *playlists;
+
+    int order;
+    int preload;
+    int prefetch;
+    int prefetch_rate;
+    int prefetch_timeout;
+    double budget;
+    int filter;
+    int draft;
+    double draft_time;
+    int compress;
+    int textures;
+    size_t shared_size;
+    int shared_fd;
+    struct SharedHeader *shared;
+
+    int span_width;
+    int span_height;
+    int bezel;
+
+    size_t vram_budget;
+    size_t memory;
+    uint64_t stream;
+    int threads;
+    size_t vram_used;
+    uint64_t cache_clock;
+
     float fade;
     int idle;
     int smoothfunction;
 
     bool running;
     bool fading;
+    bool obscured;
+    bool covered;
+    bool blanked;
+    bool power_changed;
+    bool suspended;
+    bool has_dpms;
+    bool has_randr;
+    bool has_saver;
     bool center;
-    bool mirror[MAX_MONITORS];
+    bool span;
+    bool rewind;
+    bool fade_queued;
+    bool warm;
+    bool gpu;
+    bool screens;
+    int npaths;
+    bool *mirror;
+    float *fps;
+    float default_fps;
+
+    int workers;
+    struct timespec started;
+    double startup;
+    struct timespec queued;
+    double transition;
+    double transition_max;
+    int transitions;
+
+    GLint *vertices;
+    GLfloat *texcoords;
+    bool quads_stale;
 
     char lower[PATH_MAX];
     char default_path[PATH_MAX];
+    char config_path[PATH_MAX];
+
+    unsigned overrides;
+
+    int randr_event;
+    int saver_event;
 
-    char *shmem;
+    int epoll;
+    int server;
+    int xfd;
+    int inotify;
+
+    struct Client *clients;
+    struct Client *client;
+    struct Client *closed;
 
     struct Plane *planes;
     struct Path *paths;
     struct OpenGL opengl;
+    struct Prefetch *prefetcher;
+    struct Decoder *decoder;
+
+    struct Snapshot *snapshots;
+    pthread_t snapshot;
+    bool snapshotting;
 } settings;
 
 pthread_t thread;
 
-Window findByClass(const char *classname);
+Window findByClass(Window root, const char *classname);
 Window findDesktop();
+void findLower();
+void matchWindow(Window wid);
+void matchClients();
+bool isFullscreen(Window wid);
+void coverPlanes();
+bool headCovered(int head);
+void keepBottom(bool target);
 float getDeltaTime();
+void processEvents();
+void checkPower();
+bool isVisible();
 int getMonitorsXRR();
 int getMonitorsXinerama();
+void setViewport();
+void monitorsChanged();
 void initOpengl();
 int init();
+int initHead(int index, int screen, int argc, char **argv);
+void useHead(int index);
+void usePlane(struct Plane *plane);
+bool ownWindow(Window wid);
 void gotsig(int signum);
-void shutdown();
+void cleanup();
 void drawplane(struct Plane *plane, uint32_t texture, float alpha);
-void drawplanes();
+void buildQuads();
+void fillQuads();
+void drawPlane(int monitor, uint32_t texture, float alpha);
+void drawFade(int monitor, uint32_t back, uint32_t front, float alpha);
+float fadeStep();
+void drawPlanes(float alpha);
 void update();
 int checkfile(char *file);
-char **getfiles(int monitor);
-void cleanFiles(char **files, int total_files);
-void ThrowWandException(MagickWand *wand);
+const char *orderName(int order);
+int parseOrder(const char *name);
+const char *filterName(int filter);
+int parseFilter(const char *name, int fallback);
+struct Index *getFiles(int monitor);
+void *indexWorker(void *arg);
+void indexRun(struct IndexScan *scan);
+void indexScan(struct IndexScan *scan);
+void indexSwap(int monitor, struct IndexScan *scan);
+void indexAbandon(struct IndexScan *scan);
+void indexCollect();
+void cleanFiles(struct Index *index);
+bool patternTime(const char *pattern, struct timespec *mtime);
+bool indexStale(struct Index *index, const char *pattern);
+bool pickPath(int monitor, const char *not, char *path);
+void markFailed(int monitor, const char *path);
+bool nextPath(int monitor, const char *not, char *path);
+void queuePath(int monitor, const char *path, bool queued);
+void fillLookahead(int monitor, int count);
+int preloadImages(int monitor);
+void prefetchImages(int monitor);
+void prefetchPush(const char *path);
+bool prefetchReady(const char *path);
+bool prefetchFile(const char *path, unsigned char *buffer, double rate,
+                  double timeout);
+void *prefetchWorker(void *arg);
+void lowerPriority();
+struct Decoder *decodeStart();
+int decodeWorkers();
+void decodeGrow(struct Decoder *dec, int workers);
+void decodePush(int monitor, const char *path, bool back);
+void thumbPush(struct Client *client, const char *path, int width,
+               int height);
+void thumbDone(struct DecodeJob *job);
+void decodeForget(struct Client *client);
+void decodeRemap(const int *remap, int old_nmon);
+struct Plane *jobPlane(const struct DecodeJob *job);
+void decodeCollect();
+void decodeBudget();
+void decodeStop();
+void *decodeWorker(void *arg);
+void placeTexture(uint32_t *id, struct DecodeJob *job);
+void clearLookahead(int monitor);
+void queueNext(int monitor);
+void wandError(MagickWand *wand);
+bool readImage(MagickWand *wand, const char *current);
+bool validImage(const char *path);
 MagickWand *doMagick(const char *current, int width, int height);
+bool fitImage(MagickWand *wand, int width, int height);
+bool cropImage(MagickWand *wand, int width, int height);
+bool resizeImage(MagickWand *wand, int width, int height, int filter);
+unsigned char *draftPixels(const char *current, int width, int height,
+                           MagickWand **wand);
+unsigned char *loadPixels(const char *current, int width, int height);
+unsigned char *loadSource(const char *current, int width, int height,
+                          int *src_width, int *src_height);
+bool gpuInit();
+bool gpuResize(uint32_t *id, const unsigned char *data, int src_width,
+               int src_height, int width, int height);
+bool streamCrop(struct Stream *stream, int src_width, int src_height,
+                int width, int height);
+void streamBegin(struct Stream *stream, size_t line);
+void streamRow(struct Stream *stream, const unsigned char *row, int y);
+bool streamDone(struct Stream *stream);
+unsigned char *streamFinish(struct Stream *stream);
+unsigned char *streamPixels(const char *path, int width, int height,
+                            bool *refused);
+#ifdef HAVE_JPEG
+unsigned char *streamJpeg(FILE *file, int width, int height, bool *refused);
+#endif
+#ifdef HAVE_PNG
+unsigned char *streamPng(FILE *file, int width, int height);
+#endif
+unsigned char *exportPixels(MagickWand *wand, int width, int height);
+bool getCacheDir(char *dir, bool create);
+bool imageKey(const char *path, int width, int height, uint64_t *key);
+bool diskPath(const char *path, int width, int height, char *file);
+void getSharedName(char *name, size_t size);
+int sharedLock();
+bool sharedAttach();
+void sharedDetach();
+unsigned char *sharedGet(uint64_t key, int width, int height);
+void sharedPut(uint64_t key, int width, int height, const unsigned char *data);
+unsigned char *diskRead(const char *path, int width, int height);
+bool diskWrite(const char *path, int width, int height,
+               const unsigned char *data);
+bool writePixels(const char *file, int width, int height,
+                 const unsigned char *data, const char *trailer);
+void snapshotPath(int monitor, char *file);
+void *snapshotWorker(void *arg);
+void snapshotWait();
+void snapshotFlush();
+void saveSnapshot(int monitor);
+bool loadSnapshot(int monitor);
+int loadSnapshots();
+bool parseGeometry(const char *geometry);
+int precacheImage(struct Precache *job);
+int precacheImages(char *paths, const char *geometry);
+void uploadTexture(uint32_t *id, const unsigned char *data, int width,
+                   int height, int stride);
+void uploadRaw(uint32_t *id, const unsigned char *data, int width,
+               int height, int stride);
+const char *compressName(int compress);
+int parseCompress(const char *name);
+void encodeBC1(const unsigned char *data, int width, int height, int stride,
+               unsigned char *out);
+void encodeBlock(unsigned char block[16][3], unsigned char *out);
+uint16_t packRGB565(const unsigned char *rgb);
+void deleteTextures(int n, uint32_t *ids);
+int countDescriptors();
 void loadTexture(const char *current, uint32_t *id, int width, int height);
+size_t textureBytes(struct Plane *plane);
+void cachePut(struct Plane *plane, uint32_t texture, const char *path);
+uint32_t cacheTake(struct Plane *plane, const char *path);
+bool cacheHas(struct Plane *plane, const char *path);
+bool cacheEvict();
+void cacheFlush(struct Plane *plane);
+void historyPush(struct Plane *plane, const char *path);
+void setImage(uint32_t *side, struct Plane *plane, const char *path);
+bool animatedType(const char *path);
+bool isAnimated(const char *path);
+void *animationWorker(void *arg);
+bool animationPush(struct Animation *anim, unsigned char *data, float delay);
+void animationStart(int monitor);
+void animationStop(struct Plane *plane);
+float animationTick(struct Plane *plane);
+uint32_t frontTexture(struct Plane *plane);
 void randomImage(uint32_t *side, struct Plane *plane, const char *not,
                  int monitor);
 void randomImages(int monitor);
+void spanLayout();
+void spanImage(bool front, const char *not);
+void spanSetImage(bool front, const char *path);
+void spanPreload(const char *path);
+void randomSpan();
 int parsePaths(char *paths, int (*outputPtr)(const char *, ...));
+int normalizePath(int monitor, int (*outputPtr)(const char *, ...));
 int handler(Display *dpy, XErrorEvent *e);
-int getProcIdByName(const char *proc_name);
-char *createSharedMemory(size_t size, int parent);
 int messageRespond(const char *format, ...);
+char *nextToken(char **rest);
+void handleMessage(const char *message);
+void displayName(char *name, size_t size);
+bool privateDir(const char *dir);
+bool getInstancePath(char *path, size_t size, const char *ext);
+bool getSocketPath(char *path);
+int lockInstance();
+int connectSocket();
+char *absoluteMessage(const char *message);
+int sendMessage(const char *message);
+bool watchFd(int fd, uint32_t events, void *ptr, int op);
+bool startServer();
+void stopServer();
+void clientAccept();
+void clientClose(struct Client *client);
+void clientReap();
+void clientWrite(struct Client *client, const char *data, size_t len);
+bool clientFlush(struct Client *client);
+void clientRead(struct Client *client);
+void waitEvents(int timeout);
+int emitEvent(const char *format, ...);
+void startFade();
+double secondsSince(const struct timespec *since);
+const char *getHomeDir();
+void growMonitors(int count);
+int monitorKeys(dictionary *ini, const char *section);
 void loadConfig();
+bool watchConfig();
+void configChanged();
+void reloadConfig();
+void keepOverrides(const struct _settings *old, const struct Path *paths,
+                   const bool *mirror);
 void printConfig();
+void printStats();
+void limitMemory();
+void trimMemory();
+bool previousImages();
+void gotoImage(const char *path);
 
 int handler(Display *dpy, XErrorEvent *e)
 {
@@ -143,1411 +738,7777 @@ int handler(Display *dpy, XErrorEvent *e)
     return 0;
 }
 
-Window findByClass(const char *classname)
+Window findByClass(Window root, const char *classname)
 {
     unsigned int n;
-    Window troot, parent, *children;
+    Window troot, parent, *children = NULL;
+    Window found = 0;
     char *name;
-    XWindowAttributes attrs;
-
-    XQueryTree(settings.dpy, settings.root, &troot, &parent, &children, &n);
 
-    for (unsigned int i = 0; i < n; i++) {
-        int status = XFetchName(settings.dpy, children[i], &name);
-        status |= XGetWindowAttributes(settings.dpy, children[i], &attrs);
+    if (!XQueryTree(settings.dpy, root, &troot, &parent, &children, &n)) {
+        return 0;
+    }
 
-        if ((status != 0) && (NULL != name)) {
-            if ((!strncmp(name, classname, strlen(classname)))) {
-                XFree(children);
-                XFree(name);
+    for (unsigned int i = 0; i < n && found == 0; i++) {
+        name = NULL;
 
-                return children[i];
+        if (XFetchName(settings.dpy, children[i], &name) && name != NULL) {
+            if (!strncmp(name, classname, strlen(classname))) {
+                found = children[i];
             }
 
-            if (name) {
-                XFree(name);
-            }
+            XFree(name);
         }
     }
 
-    return 0;
+    if (children != NULL) {
+        XFree(children);
+    }
+
+    return found;
 }
 
 Window findDesktop()
 {
     unsigned int n;
-    Window troot, parent, *children;
+    Window troot, parent, *children = NULL;
+    Window found = settings.root;
     char *name;
     XWindowAttributes attrs;
 
-    XQueryTree(settings.dpy, settings.root, &troot, &parent, &children, &n);
-
-    for (unsigned int i = 0; i < n; i++) {
-        int status = XFetchName(settings.dpy, children[i], &name);
-        status |= XGetWindowAttributes(settings.dpy, children[i], &attrs);
-
-        if ((status != 0) && (NULL != name)) {
-            if (
-                (attrs.map_state != 0) &&
-                (attrs.width == settings.scr->width) &&
-                (attrs.height == settings.scr->height) &&
-                (!strcmp(name, "Desktop"))
-            ) {
-                settings.win = children[i];
-                XFree(children);
-                XFree(name);
+    if (!XQueryTree(settings.dpy, settings.root, &troot, &parent, &children, &n)) {
+        return settings.root;
+    }
 
-                return children[i];
-            }
+    for (unsigned int i = 0; i < n && found == settings.root; i++) {
+        name = NULL;
+
+        if (
+            XFetchName(settings.dpy, children[i], &name) &&
+            name != NULL &&
+            XGetWindowAttributes(settings.dpy, children[i], &attrs) &&
+            attrs.map_state != 0 &&
+            attrs.width == settings.scr->width &&
+            attrs.height == settings.scr->height &&
+            !strcmp(name, "Desktop")
+        ) {
+            settings.win = children[i];
+            found = children[i];
+        }
 
-            if (name) {
-                XFree(name);
-            }
+        if (name != NULL) {
+            XFree(name);
         }
     }
 
-    return settings.root;
-}
-
-float getDeltaTime()
-{
-    static struct timespec last_ts;
-    struct timespec ts;
-    clock_gettime(CLOCK_MONOTONIC, &ts);
-    float difftime = (ts.tv_sec * 1000 + ts.tv_nsec / 1000000) -
-                     (last_ts.tv_sec * 1000 + last_ts.tv_nsec / 1000000);
+    if (children != NULL) {
+        XFree(children);
+    }
 
-    last_ts = ts;
-    return difftime * 0.001f;
+    return found;
 }
 
-int getMonitorsXinerama()
+void findLower()
 {
-    if (!XineramaIsActive(settings.dpy)) {
-        return 0;
-    }
-
-    XineramaScreenInfo *monitors = XineramaQueryScreens(
-                                       settings.dpy,
-                                       &settings.nmon
-                                   );
+    settings.lower_win = 0;
 
-    if (monitors == 0) {
-        return 0;
+    if (settings.lower[0] == 0) {
+        return;
     }
 
-    settings.planes = malloc(settings.nmon * sizeof(struct Plane));
-    settings.nfiles = malloc(settings.nmon * sizeof(int));
-
-    for (int i = 0; i < settings.nmon; i++) {
-        settings.planes[i].width = monitors[i].width;
-        settings.planes[i].height = monitors[i].height;
-        settings.planes[i].x = monitors[i].x_org;
-        settings.planes[i].y = monitors[i].y_org;
+    Window wid = 0;
 
-        settings.planes[i].front = 0;
-        settings.planes[i].back = 0;
+    // One scan now, anything mapped later arrives as an event.
+    for (int i = 0; i < settings.nheads && wid == 0; i++) {
+        wid = findByClass(settings.heads[i].root, settings.lower);
+    }
 
-        printf(
-            "monitor: %d %dx%d+%d+%d\n",
-            i,
-            monitors[i].width,
-            monitors[i].height,
-            monitors[i].x_org,
-            monitors[i].y_org
-        );
+    if (wid != 0) {
+        printf("Found %s (%lu)\n", settings.lower, wid);
+        settings.lower_win = wid;
+        keepBottom(true);
+    } else {
+        matchClients();
     }
 
-    return 1;
+    if (settings.lower_win == 0) {
+        printf("Waiting for %s...\n", settings.lower);
+    }
 }
 
-int getMonitorsXRR()
+void matchWindow(Window wid)
 {
-    XRRMonitorInfo *monitors = XRRGetMonitors(
-                                   settings.dpy,
-                                   settings.root,
-                                   0,
-                                   &settings.nmon
-                               );
+    char *name = NULL;
 
-    if (monitors == 0) {
-        return 0;
+    if (settings.lower[0] == 0 || settings.lower_win != 0 || ownWindow(wid)) {
+        return;
     }
 
-    settings.planes = malloc(settings.nmon * sizeof(struct Plane));
-    settings.nfiles = malloc(settings.nmon * sizeof(int));
-
-    for (int i = 0; i < settings.nmon; i++) {
-        settings.planes[i].width = monitors[i].width;
-        settings.planes[i].height = monitors[i].height;
-        settings.planes[i].x = monitors[i].x;
-        settings.planes[i].y = monitors[i].y;
-
-        settings.planes[i].front = 0;
-        settings.planes[i].back = 0;
+    if (XFetchName(settings.dpy, wid, &name) && name != NULL) {
+        if (!strncmp(name, settings.lower, strlen(settings.lower))) {
+            printf("Found %s (%lu)\n", settings.lower, wid);
+            settings.lower_win = wid;
+            keepBottom(true);
+        }
 
-        printf(
-            "monitor: %d %dx%d+%d+%d\n",
-            i,
-            monitors[i].width,
-            monitors[i].height,
-            monitors[i].x,
-            monitors[i].y
-        );
+        XFree(name);
     }
-
-    XRRFreeMonitors(monitors);
-    return 1;
 }
 
-void initOpengl()
+void matchClients()
 {
-    settings.opengl.ctx = glXCreateContext(
-                              settings.dpy,
-                              settings.vi,
-                              NULL,
-                              GL_TRUE
-                          );
+    for (int i = 0; i < settings.nheads && settings.lower_win == 0; i++) {
+        Atom type;
+        int format;
+        unsigned long n, after;
+        unsigned char *data = NULL;
+
+        // Managed windows sit inside frames, the client list names them.
+        if (
+            XGetWindowProperty(
+                settings.dpy,
+                settings.heads[i].root,
+                settings.client_list,
+                0,
+                4096,
+                False,
+                XA_WINDOW,
+                &type,
+                &format,
+                &n,
+                &after,
+                &data
+            ) != Success || data == NULL
+        ) {
+            continue;
+        }
 
-    if (!settings.opengl.ctx) {
-        fprintf(stderr, "Error: glXCreateContext failed\n");
-        exit(-1);
-    }
+        Window *clients = (Window *)data;
 
-    glXMakeCurrent(settings.dpy, settings.win, settings.opengl.ctx);
+        for (unsigned long j = 0; j < n && settings.lower_win == 0; j++) {
+            matchWindow(clients[j]);
+        }
 
-    printf("GL_RENDERER = %s\n", (char *) glGetString(GL_RENDERER));
+        XFree(data);
+    }
+}
 
-    //glEnable(GL_DEPTH_TEST);
-    glEnable(GL_BLEND);
-    glEnable(GL_TEXTURE_2D);
+bool isFullscreen(Window wid)
+{
+    Atom type;
+    int format;
+    unsigned long n, after;
+    unsigned char *data = NULL;
+    bool found = false;
 
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    if (
+        XGetWindowProperty(
+            settings.dpy,
+            wid,
+            settings.wm_state,
+            0,
+            64,
+            False,
+            XA_ATOM,
+            &type,
+            &format,
+            &n,
+            &after,
+            &data
+        ) != Success || data == NULL
+    ) {
+        return false;
+    }
 
-    glMatrixMode(GL_PROJECTION);
-    glLoadIdentity();
+    Atom *states = (Atom *)data;
 
-    glOrtho(0, settings.scr->width, settings.scr->height, 0, -100.0f, 100.0f);
-    glViewport(0, 0, settings.scr->width, settings.scr->height);
+    for (unsigned long i = 0; i < n && !found; i++) {
+        found = states[i] == settings.wm_fullscreen;
+    }
 
-    glClearColor(0, 0, 0, 1);
+    XFree(data);
+
+    return found;
 }
 
-int init(int argc, char **argv)
+void coverPlanes()
 {
-    #ifdef GraphicsMagick
-    InitializeMagick(*argv);
-    #else
-    MagickWandGenesis();
-    #endif
+    bool covered = settings.nmon > 0;
 
+    settings.nfullscreen = 0;
 
-    settings.dpy = XOpenDisplay(NULL);
-
-    if (settings.dpy == NULL) {
-        fprintf(stderr, "Cannot connect to X server\n");
-        return 0;
+    for (int i = 0; i < settings.nmon; i++) {
+        settings.planes[i].covered = false;
     }
 
-    XSetErrorHandler(handler);
-
-    settings.scr = DefaultScreenOfDisplay(settings.dpy);
-
-    if (settings.scr == NULL) {
-        fprintf(stderr, "No screen found\n");
-        return 0;
-    }
+    // VisibilityNotify only knows about whole screens, and nothing at all
+    // under a compositor. A fullscreen client hides exactly its output.
+    for (int i = 0; i < settings.nheads; i++) {
+        Atom type;
+        int format;
+        unsigned long n, after;
+        unsigned char *data = NULL;
+
+        if (
+            XGetWindowProperty(
+                settings.dpy,
+                settings.heads[i].root,
+                settings.client_list,
+                0,
+                4096,
+                False,
+                XA_WINDOW,
+                &type,
+                &format,
+                &n,
+                &after,
+                &data
+            ) != Success || data == NULL
+        ) {
+            continue;
+        }
 
-    printf("ScreenSize: %dx%d\n", settings.scr->width, settings.scr->height);
+        Window *clients = (Window *)data;
 
-    GLint vi_att[] = { GLX_RGBA, GLX_DEPTH_SIZE, 24, GLX_DOUBLEBUFFER, None };
-    settings.vi = glXChooseVisual(settings.dpy, settings.screen, vi_att);
+        for (unsigned long j = 0; j < n; j++) {
+            XWindowAttributes attr;
+            Window child;
+            int x, y;
 
-    if (settings.vi == NULL) {
-        fprintf(stderr, "No appropriate visual found\n");
-        return 0;
-    }
+            if (ownWindow(clients[j])) {
+                continue;
+            }
 
-    settings.root = RootWindow(settings.dpy, settings.screen);
+            // State changes are then reported as PropertyNotify.
+            XSelectInput(settings.dpy, clients[j], PropertyChangeMask);
 
-    if (strlen(settings.lower)) {
-        printf("Waiting for %s...\n", settings.lower);
+            if (
+                !isFullscreen(clients[j]) ||
+                !XGetWindowAttributes(settings.dpy, clients[j], &attr) ||
+                attr.map_state != IsViewable ||
+                !XTranslateCoordinates(
+                    settings.dpy,
+                    clients[j],
+                    settings.heads[i].root,
+                    0,
+                    0,
+                    &x,
+                    &y,
+                    &child
+                )
+            ) {
+                continue;
+            }
 
-        Window wid = 0;
+            settings.nfullscreen++;
 
-        do {
-            wid = findByClass(settings.lower);
+            for (int k = 0; k < settings.nmon; k++) {
+                struct Plane *plane = &settings.planes[k];
 
-            if (wid != 0) {
-                break;
+                if (
+                    plane->head == i &&
+                    x <= plane->x &&
+                    y <= plane->y &&
+                    x + attr.width >= plane->x + plane->width &&
+                    y + attr.height >= plane->y + plane->height
+                ) {
+                    plane->covered = true;
+                }
             }
+        }
 
-            usleep(100000);
-        } while (1);
+        XFree(data);
+    }
 
-        printf("Found %s (%lu)\n", settings.lower, wid);
-        XLowerWindow(settings.dpy, wid);
+    for (int i = 0; i < settings.nmon; i++) {
+        covered &= settings.planes[i].covered;
     }
 
-    XSetWindowAttributes attr = {0};
-    attr.override_redirect = 1;
+    settings.covered = covered;
+}
+
+bool headCovered(int head)
+{
+    for (int i = 0; i < settings.nmon; i++) {
+        if (settings.planes[i].head == head && !settings.planes[i].covered) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void keepBottom(bool target)
+{
+    if (target && settings.lower_win != 0) {
+        XLowerWindow(settings.dpy, settings.lower_win);
+    }
+
+    for (int i = 0; i < settings.nheads; i++) {
+        XLowerWindow(settings.dpy, settings.heads[i].win);
+    }
+}
+
+float getDeltaTime()
+{
+    static struct timespec last_ts;
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    float difftime = (ts.tv_sec * 1000 + ts.tv_nsec / 1000000) -
+                     (last_ts.tv_sec * 1000 + last_ts.tv_nsec / 1000000);
+
+    last_ts = ts;
+    return difftime * 0.001f;
+}
+
+void processEvents()
+{
+    XEvent ev;
+    bool hotplug = false;
+    bool cover = false;
+
+    while (XPending(settings.dpy)) {
+        XNextEvent(settings.dpy, &ev);
+
+        if (
+            settings.has_randr && (
+                ev.type == settings.randr_event + RRScreenChangeNotify ||
+                ev.type == settings.randr_event + RRNotify
+            )
+        ) {
+            XRRUpdateConfiguration(&ev);
+            hotplug = true;
+            continue;
+        }
+
+        if (
+            settings.has_saver &&
+            ev.type == settings.saver_event + ScreenSaverNotify
+        ) {
+            settings.power_changed = true;
+            continue;
+        }
+
+        switch (ev.type) {
+            case MapNotify:
+                if (ev.xmap.window == settings.lower_win) {
+                    keepBottom(true);
+                } else {
+                    matchWindow(ev.xmap.window);
+                }
+
+                break;
+
+            case DestroyNotify:
+                if (ev.xdestroywindow.window == settings.lower_win) {
+                    printf("Lost %s\n", settings.lower);
+                    settings.lower_win = 0;
+                }
+
+                break;
+
+            case ConfigureNotify:
+
+                // Something went to the bottom, go back under it. Our own
+                // restacking lands above None only for the lower window,
+                // which then just needs wallfade pushed below it again.
+                if (
+                    ev.xconfigure.above == None &&
+                    !ownWindow(ev.xconfigure.window)
+                ) {
+                    keepBottom(ev.xconfigure.window != settings.lower_win);
+                }
+
+                // A fullscreen window may have moved to another output.
+                cover |= settings.nfullscreen > 0;
+                break;
+
+            case PropertyNotify:
+                if (
+                    ev.xproperty.atom == settings.client_list &&
+                    settings.lower_win == 0
+                ) {
+                    matchClients();
+                }
+
+                cover |= (
+                    ev.xproperty.atom == settings.client_list ||
+                    ev.xproperty.atom == settings.wm_state
+                );
+                break;
+
+            case VisibilityNotify:
+                settings.obscured = true;
+
+                // Only hidden when every screen is.
+                for (int i = 0; i < settings.nheads; i++) {
+                    struct Head *head = &settings.heads[i];
+
+                    if (ev.xvisibility.window == head->win) {
+                        head->obscured = (
+                            ev.xvisibility.state == VisibilityFullyObscured
+                        );
+                    }
+
+                    settings.obscured &= head->obscured;
+                }
+
+                break;
+
+            default:
+                break;
+        }
+    }
+
+    if (hotplug) {
+        monitorsChanged();
+    }
+
+    if (hotplug || cover) {
+        coverPlanes();
+    }
+}
+
+void checkPower()
+{
+    static float last_check = POWER_CHECK_TIME;
+    static bool saver = false;
+
+    last_check += settings.seconds;
+
+    // The screen saver reports its changes and is only asked then. DPMS has
+    // no events, "xset dpms force off" never touches the screen saver, so
+    // it is still polled, DPMSInfo is a single cheap round trip.
+    if (settings.power_changed && settings.has_saver) {
+        XScreenSaverInfo *info = XScreenSaverAllocInfo();
+
+        if (info != NULL) {
+            if (XScreenSaverQueryInfo(settings.dpy, settings.root, info)) {
+                saver = (info->state == ScreenSaverOn);
+            }
+
+            XFree(info);
+        }
+    }
+
+    if (!settings.power_changed && last_check < POWER_CHECK_TIME) {
+        return;
+    }
+
+    last_check = 0;
+    settings.power_changed = false;
+
+    bool blanked = saver;
+
+    if (!blanked && settings.has_dpms) {
+        CARD16 level;
+        BOOL enabled;
+
+        if (DPMSInfo(settings.dpy, &level, &enabled) && enabled) {
+            blanked = (level != DPMSModeOn);
+        }
+    }
+
+    settings.blanked = blanked;
+}
+
+bool isVisible()
+{
+    return !settings.obscured && !settings.covered && !settings.blanked;
+}
+
+int getMonitorsXinerama()
+{
+    if (!XineramaIsActive(settings.dpy)) {
+        return 0;
+    }
+
+    XineramaScreenInfo *monitors = XineramaQueryScreens(
+                                       settings.dpy,
+                                       &settings.nmon
+                                   );
+
+    if (monitors == 0) {
+        return 0;
+    }
+
+    settings.planes = calloc(settings.nmon, sizeof(struct Plane));
+    settings.nfiles = calloc(settings.nmon, sizeof(int));
+    growMonitors(settings.nmon);
+
+    for (int i = 0; i < settings.nmon; i++) {
+        settings.planes[i].width = monitors[i].width;
+        settings.planes[i].height = monitors[i].height;
+        settings.planes[i].x = monitors[i].x_org;
+        settings.planes[i].y = monitors[i].y_org;
+
+        settings.planes[i].front = 0;
+        settings.planes[i].back = 0;
+
+        settings.planes[i].front_path[0] = '\0';
+        settings.planes[i].back_path[0] = '\0';
+
+        settings.planes[i].cache = NULL;
+        settings.planes[i].ncache = 0;
+        settings.planes[i].history = NULL;
+        settings.planes[i].nhistory = 0;
+        settings.planes[i].anim = NULL;
+
+        printf(
+            "monitor: %d %dx%d+%d+%d\n",
+            i,
+            monitors[i].width,
+            monitors[i].height,
+            monitors[i].x_org,
+            monitors[i].y_org
+        );
+    }
+
+    settings.quads_stale = true;
+
+    return 1;
+}
+
+int getMonitorsXRR()
+{
+    settings.nmon = 0;
+    settings.planes = NULL;
+    settings.nfiles = NULL;
+
+    // Monitors of every screen end up in one list, tagged with their head.
+    for (int h = 0; h < settings.nheads; h++) {
+        int count = 0;
+        XRRMonitorInfo *monitors = XRRGetMonitors(
+                                       settings.dpy,
+                                       settings.heads[h].root,
+                                       0,
+                                       &count
+                                   );
+
+        if (monitors == 0) {
+            continue;
+        }
+
+        settings.planes = realloc(
+                              settings.planes,
+                              (settings.nmon + count) * sizeof(struct Plane)
+                          );
+        settings.nfiles = realloc(
+                              settings.nfiles,
+                              (settings.nmon + count) * sizeof(int)
+                          );
+
+        for (int i = 0; i < count; i++) {
+            struct Plane *plane = &settings.planes[settings.nmon];
+
+            memset(plane, 0, sizeof(struct Plane));
+
+            plane->width = monitors[i].width;
+            plane->height = monitors[i].height;
+            plane->x = monitors[i].x;
+            plane->y = monitors[i].y;
+            plane->head = h;
+
+            printf(
+                "monitor: %d %dx%d+%d+%d\n",
+                settings.nmon,
+                monitors[i].width,
+                monitors[i].height,
+                monitors[i].x,
+                monitors[i].y
+            );
+
+            settings.nmon++;
+        }
+
+        XRRFreeMonitors(monitors);
+    }
+
+    if (settings.nmon == 0) {
+        free(settings.planes);
+        free(settings.nfiles);
+
+        return 0;
+    }
+
+    growMonitors(settings.nmon);
+    settings.quads_stale = true;
+
+    return 1;
+}
+
+void setViewport()
+{
+    glMatrixMode(GL_PROJECTION);
+    glLoadIdentity();
+
+    glOrtho(0, settings.scr->width, settings.scr->height, 0, -100.0f, 100.0f);
+    glViewport(0, 0, settings.scr->width, settings.scr->height);
+}
+
+void monitorsChanged()
+{
+    struct Plane *old_planes = settings.planes;
+    int *old_nfiles = settings.nfiles;
+    int old_nmon = settings.nmon;
+
+    for (int i = 0; i < settings.nheads; i++) {
+        useHead(i);
+
+        printf("ScreenSize: %dx%d\n", settings.scr->width, settings.scr->height);
+
+        XResizeWindow(
+            settings.dpy,
+            settings.win,
+            settings.scr->width,
+            settings.scr->height
+        );
+        setViewport();
+    }
+
+    if (!getMonitorsXRR()) {
+        settings.planes = old_planes;
+        settings.nfiles = old_nfiles;
+        settings.nmon = old_nmon;
+
+        return;
+    }
+
+    bool *kept = calloc(old_nmon, sizeof(bool));
+    bool *fresh = calloc(settings.nmon, sizeof(bool));
+    int *remap = calloc(old_nmon, sizeof(int));
+    struct Playlist *playlists = calloc(settings.nmon, sizeof(struct Playlist));
+
+    // Outputs that kept their size keep their textures, even if they moved.
+    for (int i = 0; i < settings.nmon; i++) {
+        struct Plane *plane = &settings.planes[i];
+        int match = -1;
+
+        for (int j = 0; j < old_nmon; j++) {
+            if (
+                !kept[j] &&
+                old_planes[j].head == plane->head &&
+                old_planes[j].width == plane->width &&
+                old_planes[j].height == plane->height &&
+                (match < 0 || j == i)
+            ) {
+                match = j;
+            }
+        }
+
+        if (match < 0) {
+            fresh[i] = true;
+            settings.nfiles[i] = 0;
+            continue;
+        }
+
+        int x = plane->x;
+        int y = plane->y;
+
+        *plane = old_planes[match];
+        plane->x = x;
+        plane->y = y;
+
+        kept[match] = true;
+        remap[match] = i + 1;
+        settings.nfiles[i] = old_nfiles[match];
+
+        // Queued wallpapers follow their output to its new index.
+        if (settings.playlists != NULL) {
+            playlists[i] = settings.playlists[match];
+        }
+    }
+
+    // Decodes in flight still name the old index.
+    decodeRemap(remap, old_nmon);
+
+    for (int j = 0; j < old_nmon; j++) {
+        if (!kept[j]) {
+            usePlane(&old_planes[j]);
+            animationStop(&old_planes[j]);
+            cacheFlush(&old_planes[j]);
+            deleteTextures(1, &old_planes[j].front);
+            deleteTextures(1, &old_planes[j].back);
+            free(old_planes[j].history);
+        }
+    }
+
+    for (int i = 0; settings.index && i < old_nmon; i++) {
+        cleanFiles(&settings.index[i]);
+    }
+
+    free(settings.index);
+    settings.index = NULL;
+
+    for (int j = 0; settings.playlists && j < old_nmon; j++) {
+        if (!kept[j]) {
+            free(settings.playlists[j].entries);
+        }
+    }
+
+    free(settings.playlists);
+    settings.playlists = playlists;
+
+    for (int i = 0; i < settings.nmon; i++) {
+        normalizePath(i, printf);
+    }
+
+    if (settings.span) {
+        // The panorama is cut differently now, every slice is stale.
+        for (int i = 0; i < settings.nmon; i++) {
+            cacheFlush(&settings.planes[i]);
+        }
+
+        spanLayout();
+        randomSpan();
+    } else {
+        for (int i = 0; i < settings.nmon; i++) {
+            if (fresh[i]) {
+                printf("Loading monitor %d\n", i);
+                randomImages(i);
+            }
+        }
+    }
+
+    free(kept);
+    free(fresh);
+    free(remap);
+    free(old_planes);
+    free(old_nfiles);
+
+    emitEvent("hotplug %d\n", settings.nmon);
+}
+
+void initOpengl()
+{
+    settings.opengl.ctx = glXCreateContext(
+                              settings.dpy,
+                              settings.vi,
+                              NULL,
+                              GL_TRUE
+                          );
+
+    if (!settings.opengl.ctx) {
+        fprintf(stderr, "Error: glXCreateContext failed\n");
+        exit(-1);
+    }
+
+    glXMakeCurrent(settings.dpy, settings.win, settings.opengl.ctx);
+
+    printf("GL_RENDERER = %s\n", (char *) glGetString(GL_RENDERER));
+
+    //glEnable(GL_DEPTH_TEST);
+    glEnable(GL_BLEND);
+    glEnable(GL_TEXTURE_2D);
+
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+    setViewport();
+
+    glClearColor(0, 0, 0, 1);
+
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+    const char *extensions = (const char *)glGetString(GL_EXTENSIONS);
+
+    // Every head has to handle the format, later ones can only lower it.
+    if (settings.head <= 0) {
+        settings.opengl.format = settings.compress;
+    }
+
+    if (
+        settings.compress == COMPRESS_BC1 &&
+        (
+            extensions == NULL ||
+            !strstr(extensions, "GL_EXT_texture_compression_s3tc")
+        )
+    ) {
+        fprintf(stderr, "No S3TC support, falling back to rgb565\n");
+        settings.opengl.format = COMPRESS_RGB565;
+    }
+
+    printf("Textures: %s\n", compressName(settings.opengl.format));
+}
+
+int init(int argc, char **argv)
+{
+    #ifdef GraphicsMagick
+    InitializeMagick(*argv);
+    #else
+    MagickWandGenesis();
+    #endif
+
+    limitMemory();
+    sharedAttach();
+
+    settings.dpy = XOpenDisplay(NULL);
+
+    if (settings.dpy == NULL) {
+        fprintf(stderr, "Cannot connect to X server\n");
+        return 0;
+    }
+
+    XSetErrorHandler(handler);
+
+    settings.client_list = XInternAtom(settings.dpy, "_NET_CLIENT_LIST", 0);
+    settings.wm_state = XInternAtom(settings.dpy, "_NET_WM_STATE", 0);
+    settings.wm_fullscreen = XInternAtom(
+                                 settings.dpy,
+                                 "_NET_WM_STATE_FULLSCREEN",
+                                 0
+                             );
+
+    int event_base, error_base;
+
+    settings.has_dpms = DPMSQueryExtension(
+                            settings.dpy,
+                            &event_base,
+                            &error_base
+                        ) && DPMSCapable(settings.dpy);
+
+    settings.has_saver = XScreenSaverQueryExtension(
+                             settings.dpy,
+                             &settings.saver_event,
+                             &error_base
+                         );
+
+    settings.has_randr = XRRQueryExtension(
+                             settings.dpy,
+                             &settings.randr_event,
+                             &error_base
+                         );
+
+    int count = settings.screens ? ScreenCount(settings.dpy) : 1;
+
+    // Slices of one panorama cannot be split over separate screens.
+    if (settings.span && count > 1) {
+        printf("Span only covers the default screen\n");
+        count = 1;
+    }
+
+    settings.heads = calloc(count, sizeof(struct Head));
+    settings.head = -1;
+
+    for (int i = 0; i < count; i++) {
+        int screen = count > 1 ? i : DefaultScreen(settings.dpy);
+
+        if (!initHead(i, screen, argc, argv)) {
+            return 0;
+        }
+
+        settings.nheads++;
+    }
+
+    settings.xfd = ConnectionNumber(settings.dpy);
+    watchFd(settings.xfd, EPOLLIN, &settings.xfd, EPOLL_CTL_ADD);
+
+    findLower();
+
+    XSync(settings.dpy, settings.win);
+
+    if (!getMonitorsXRR()) {
+        if (!getMonitorsXinerama()) {
+            fprintf(stderr, "Unable to find monitors\n");
+            exit(-1);
+        }
+    }
+
+    settings.playlists = calloc(settings.nmon, sizeof(struct Playlist));
+
+    coverPlanes();
+
+    return 1;
+}
+
+int initHead(int index, int screen, int argc, char **argv)
+{
+    struct Head *head = &settings.heads[index];
+
+    head->screen = screen;
+    head->scr = ScreenOfDisplay(settings.dpy, screen);
+
+    if (head->scr == NULL) {
+        fprintf(stderr, "No screen found\n");
+        return 0;
+    }
+
+    printf("ScreenSize: %dx%d\n", head->scr->width, head->scr->height);
+
+    GLint vi_att[] = { GLX_RGBA, GLX_DEPTH_SIZE, 24, GLX_DOUBLEBUFFER, None };
+    head->vi = glXChooseVisual(settings.dpy, screen, vi_att);
+
+    if (head->vi == NULL) {
+        fprintf(stderr, "No appropriate visual found\n");
+        return 0;
+    }
+
+    head->root = RootWindow(settings.dpy, screen);
+
+    useHead(index);
+
+    // Later windows are picked up from root events, see processEvents.
+    XSelectInput(
+        settings.dpy,
+        settings.root,
+        SubstructureNotifyMask | PropertyChangeMask
+    );
+
+    XSetWindowAttributes attr = {0};
+    attr.override_redirect = 1;
+
+    settings.desktop = findDesktop();
+    settings.win = XCreateWindow(
+                       settings.dpy,
+                       settings.desktop,
+                       0,
+                       0,
+                       settings.scr->width,
+                       settings.scr->height,
+                       0,
+                       CopyFromParent,
+                       InputOutput,
+                       CopyFromParent,
+                       CWOverrideRedirect,
+                       &attr
+                   );
+
+    XSizeHints xsh;
+    xsh.flags  = PSize | PPosition;
+    xsh.width  = settings.scr->width;
+    xsh.height = settings.scr->height;
+
+    XWMHints xwmh;
+    xwmh.flags = InputHint;
+    xwmh.input = 0;
+
+    XSetWMProperties(
+        settings.dpy,
+        settings.win,
+        NULL,
+        NULL,
+        argv,
+        argc,
+        &xsh,
+        &xwmh,
+        NULL
+    );
+
+    XClassHint hints;
+
+    hints.res_name = "wallfade";
+    hints.res_class = "Wallfade";
+
+    XSetClassHint(
+        settings.dpy,
+        settings.win,
+        &hints
+    );
+
+    Atom state[5];
+
+    state[0] = XInternAtom(settings.dpy, "_NET_WM_STATE_BELOW", 0);
+    state[1] = XInternAtom(settings.dpy, "_NET_WM_STATE_FULLSCREEN", 0);
+    state[2] = XInternAtom(settings.dpy, "_NET_WM_STATE_SKIP_PAGER", 0);
+    state[3] = XInternAtom(settings.dpy, "_NET_WM_STATE_SKIP_TASKBAR", 0);
+    state[4] = XInternAtom(settings.dpy, "_NET_WM_STATE_STICKY", 0);
+
+    Atom type = XInternAtom(settings.dpy, "_NET_WM_WINDOW_TYPE_DESKTOP", 0);
+
+    XChangeProperty(
+        settings.dpy,
+        settings.win,
+        XInternAtom(settings.dpy, "_NET_WM_STATE", 0),
+        XA_ATOM,
+        32,
+        PropModeReplace,
+        (unsigned char *) state,
+        4
+    );
+
+    XChangeProperty(
+        settings.dpy,
+        settings.win,
+        XInternAtom(settings.dpy, "_NET_WM_WINDOW_TYPE", 1),
+        XA_ATOM,
+        32,
+        PropModeReplace,
+        (unsigned char *) &type,
+        1
+    );
+
+    XSelectInput(settings.dpy, settings.win, VisibilityChangeMask);
+
+    if (settings.has_saver) {
+        XScreenSaverSelectInput(
+            settings.dpy,
+            settings.root,
+            ScreenSaverNotifyMask
+        );
+    }
+
+    if (settings.has_randr) {
+        XRRSelectInput(
+            settings.dpy,
+            settings.root,
+            RRScreenChangeNotifyMask |
+            RRCrtcChangeNotifyMask |
+            RROutputChangeNotifyMask
+        );
+    }
+
+    XMapWindow(settings.dpy, settings.win);
+    XLowerWindow(settings.dpy, settings.win);
+
+    head->desktop = settings.desktop;
+    head->win = settings.win;
+
+    initOpengl();
+    head->ctx = settings.opengl.ctx;
+
+    return 1;
+}
+
+void useHead(int index)
+{
+    struct Head *head = &settings.heads[index];
+
+    if (settings.head == index) {
+        return;
+    }
+
+    settings.head = index;
+    settings.screen = head->screen;
+    settings.scr = head->scr;
+    settings.vi = head->vi;
+    settings.root = head->root;
+    settings.desktop = head->desktop;
+    settings.win = head->win;
+    settings.opengl.ctx = head->ctx;
+
+    if (head->ctx != NULL) {
+        glXMakeCurrent(settings.dpy, head->win, head->ctx);
+    }
+}
+
+void usePlane(struct Plane *plane)
+{
+    useHead(plane->head);
+}
+
+bool ownWindow(Window wid)
+{
+    for (int i = 0; i < settings.nheads; i++) {
+        if (wid == settings.heads[i].win || wid == settings.heads[i].desktop) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void gotsig(int signum)
+{
+    settings.running = false;
+}
+
+void cleanup()
+{
+    stopServer();
+    decodeStop();
+
+    if (settings.lock >= 0) {
+        close(settings.lock);
+    }
+
+    for (int i = 0; i < settings.nmon; i++) {
+        if (settings.index) {
+            cleanFiles(&settings.index[i]);
+        }
+
+        if (settings.playlists) {
+            free(settings.playlists[i].entries);
+        }
+
+        saveSnapshot(i);
+        animationStop(&settings.planes[i]);
+        cacheFlush(&settings.planes[i]);
+        free(settings.planes[i].history);
+
+        usePlane(&settings.planes[i]);
+        deleteTextures(1, &settings.planes[i].front);
+        deleteTextures(1, &settings.planes[i].back);
+    }
+
+    snapshotFlush();
+    snapshotWait();
+
+    free(settings.planes);
+    free(settings.nfiles);
+    free(settings.paths);
+    free(settings.mirror);
+    free(settings.fps);
+    free(settings.vertices);
+    free(settings.texcoords);
+    free(settings.index);
+    free(settings.playlists);
+
+    settings.planes = NULL;
+    settings.nfiles = NULL;
+    settings.paths = NULL;
+    settings.mirror = NULL;
+    settings.fps = NULL;
+    settings.vertices = NULL;
+    settings.texcoords = NULL;
+    settings.npaths = 0;
+    settings.index = NULL;
+    settings.playlists = NULL;
+
+    glXMakeCurrent(settings.dpy, None, NULL);
+
+    for (int i = 0; i < settings.nheads; i++) {
+        glXDestroyContext(settings.dpy, settings.heads[i].ctx);
+        XFree(settings.heads[i].vi);
+    }
+
+    free(settings.heads);
+    settings.heads = NULL;
+    settings.nheads = 0;
+
+    XCloseDisplay(settings.dpy);
+    sharedDetach();
+
+    #ifdef GraphicsMagick
+    DestroyMagick();
+    #else
+    MagickWandTerminus();
+    #endif
+}
+
+void buildQuads()
+{
+    if (settings.quads_stale) {
+        fillQuads();
+        settings.quads_stale = false;
+    }
+
+    // Client arrays are per context, every head points its own at them.
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glVertexPointer(2, GL_INT, 0, settings.vertices);
+
+    glClientActiveTexture(GL_TEXTURE1);
+    glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+    glTexCoordPointer(2, GL_FLOAT, 0, settings.texcoords);
+
+    glClientActiveTexture(GL_TEXTURE0);
+    glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+    glTexCoordPointer(2, GL_FLOAT, 0, settings.texcoords);
+}
+
+void fillQuads()
+{
+    settings.vertices = realloc(
+                            settings.vertices,
+                            settings.nmon * 8 * sizeof(GLint)
+                        );
+    settings.texcoords = realloc(
+                             settings.texcoords,
+                             settings.nmon * 8 * sizeof(GLfloat)
+                         );
+
+    for (int i = 0; i < settings.nmon; i++) {
+        struct Plane *plane = &settings.planes[i];
+        GLint *v = &settings.vertices[i * 8];
+        GLfloat *t = &settings.texcoords[i * 8];
+        float mirror = settings.mirror[i];
+
+        v[0] = plane->x;
+        v[1] = plane->y;
+        v[2] = plane->x;
+        v[3] = plane->y + plane->height;
+        v[4] = plane->x + plane->width;
+        v[5] = plane->y + plane->height;
+        v[6] = plane->x + plane->width;
+        v[7] = plane->y;
+
+        t[0] = mirror;
+        t[1] = 0;
+        t[2] = mirror;
+        t[3] = 1;
+        t[4] = 1 - mirror;
+        t[5] = 1;
+        t[6] = 1 - mirror;
+        t[7] = 0;
+    }
+}
+
+void drawPlane(int monitor, uint32_t texture, float alpha)
+{
+    if (settings.planes[monitor].covered) {
+        return;
+    }
+
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glColor4f(1, 1, 1, alpha);
+    glDrawArrays(GL_QUADS, monitor * 4, 4);
+}
+
+void drawFade(int monitor, uint32_t back, uint32_t front, float alpha)
+{
+    if (settings.planes[monitor].covered) {
+        return;
+    }
+
+    // Both sides in one pass, the second unit mixes front into back.
+    GLfloat mix[4] = { 0, 0, 0, 1.0f - alpha };
+
+    glBindTexture(GL_TEXTURE_2D, back);
+    glColor4f(1, 1, 1, 1);
+
+    glActiveTexture(GL_TEXTURE1);
+    glEnable(GL_TEXTURE_2D);
+    glBindTexture(GL_TEXTURE_2D, front);
+
+    glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_COMBINE);
+    glTexEnvi(GL_TEXTURE_ENV, GL_COMBINE_RGB, GL_INTERPOLATE);
+    glTexEnvi(GL_TEXTURE_ENV, GL_SOURCE0_RGB, GL_TEXTURE);
+    glTexEnvi(GL_TEXTURE_ENV, GL_SOURCE1_RGB, GL_PREVIOUS);
+    glTexEnvi(GL_TEXTURE_ENV, GL_SOURCE2_RGB, GL_CONSTANT);
+    glTexEnvi(GL_TEXTURE_ENV, GL_OPERAND2_RGB, GL_SRC_ALPHA);
+    glTexEnvi(GL_TEXTURE_ENV, GL_COMBINE_ALPHA, GL_REPLACE);
+    glTexEnvi(GL_TEXTURE_ENV, GL_SOURCE0_ALPHA, GL_PREVIOUS);
+    glTexEnvfv(GL_TEXTURE_ENV, GL_TEXTURE_ENV_COLOR, mix);
+
+    glDrawArrays(GL_QUADS, monitor * 4, 4);
+
+    glDisable(GL_TEXTURE_2D);
+    glActiveTexture(GL_TEXTURE0);
+}
+
+float smooth(float min, float max, float val)
+{
+    float out = 0;
+
+    if (settings.smoothfunction == 1) {
+        out = val; // linear
+    } else {
+        float s = fmaxf(0, fminf(1, (val - min) / (max - min)));
+
+        switch (settings.smoothfunction) {
+            default:
+            case 2: // smoothstep
+                out = s * s * (3 - 2 * s);
+                break;
+
+            case 3: // smootherstep
+                out = s * s * (s * (s * 6 - 15) + 10);
+                break;
+        }
+    }
+
+    return out;
+}
+
+float fadeStep()
+{
+    float alpha = 0.0f;
+
+    if (settings.fading) {
+        static float linear = 0.0f;
+
+        linear += settings.fade * settings.seconds;
+        alpha = smooth(0.0f, 1.0f, linear);
+
+        if (linear > 1.0f) {
+            settings.fading = false;
+            emitEvent("fade end\n");
+
+            for (int i = 0; i < settings.nmon; i++) {
+                struct Plane *plane = &settings.planes[i];
+
+                // Nothing decodable was left to fade to, keep the front.
+                if (plane->back == 0) {
+                    if (!settings.span) {
+                        randomImage(&plane->back, plane, plane->front_path, i);
+                    }
+
+                    continue;
+                }
+
+                usePlane(plane);
+
+                if (!settings.rewind) {
+                    historyPush(plane, plane->front_path);
+                }
+
+                animationStop(plane);
+                cachePut(plane, plane->front, plane->front_path);
+
+                settings.planes[i].front = settings.planes[i].back;
+
+                sprintf(
+                    settings.planes[i].front_path,
+                    "%.*s",
+                    (int)sizeof(settings.planes[i].front_path),
+                    settings.planes[i].back_path
+                );
+
+                settings.planes[i].back = 0;
+
+                emitEvent("changed %d %s\n", i, plane->front_path);
+                animationStart(i);
+                saveSnapshot(i);
+
+                if (!settings.span) {
+                    randomImage(
+                        &settings.planes[i].back,
+                        &settings.planes[i],
+                        settings.planes[i].front_path,
+                        i
+                    );
+                }
+            }
+
+            snapshotFlush();
+
+            if (settings.span) {
+                spanImage(false, settings.planes[0].front_path);
+            }
+
+            for (int i = 0; i < (settings.span ? 1 : settings.nmon); i++) {
+                preloadImages(i);
+                prefetchImages(i);
+            }
+
+            settings.rewind = false;
+            decodeBudget();
+
+            linear = 0.0f;
+            alpha = 0.0f;
+        }
+    }
+
+    return alpha;
+}
+
+void drawPlanes(float alpha)
+{
+    buildQuads();
+
+    for (int i = 0; i < settings.nmon; i++) {
+        if (settings.planes[i].head != settings.head) {
+            continue;
+        }
+
+        if (settings.nfiles[i]) {
+            if (settings.nfiles[i] > 1) {
+                // The opaque front hides the back completely between fades.
+                if (settings.fading && settings.planes[i].back != 0) {
+                    drawFade(
+                        i,
+                        settings.planes[i].back,
+                        frontTexture(&settings.planes[i]),
+                        alpha
+                    );
+                } else {
+                    drawPlane(i, frontTexture(&settings.planes[i]), 1.0f);
+                }
+            } else {
+                drawPlane(i, frontTexture(&settings.planes[i]), 1.0f);
+
+                if (!settings.span) {
+                    randomImage(
+                        &settings.planes[i].back,
+                        &settings.planes[i],
+                        settings.planes[i].front_path,
+                        i
+                    );
+                    waitEvents(500);
+                }
+            }
+        }  else if (!settings.span) {
+            randomImages(i);
+            waitEvents(500);
+        }
+    }
+
+    if (settings.span && settings.nfiles[0] <= 1) {
+        if (settings.nfiles[0] == 1) {
+            spanImage(false, settings.planes[0].front_path);
+        } else {
+            randomSpan();
+        }
+
+        waitEvents(500);
+    }
+}
+
+int messageRespond(const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    int len = vsnprintf(NULL, 0, format, args);
+    va_end(args);
+
+    if (len < 0) {
+        return len;
+    }
+
+    char *output = malloc(len + 1);
+
+    va_start(args, format);
+    vsnprintf(output, len + 1, format, args);
+    va_end(args);
+
+    if (settings.client != NULL) {
+        clientWrite(settings.client, output, len);
+    }
+
+    printf("%s", output);
+    free(output);
+
+    return len;
+}
+
+char *nextToken(char **rest)
+{
+    char *in = *rest;
+
+    while (*in == ' ') {
+        in++;
+    }
+
+    if (*in == '\0') {
+        *rest = in;
+        return NULL;
+    }
+
+    char *token = in;
+    char *out = in;
+    char quote = 0;
+
+    // Paths may contain spaces: "a b", 'a b' and a\ b all give one token.
+    for (; *in != '\0'; in++) {
+        if (quote == 0 && *in == ' ') {
+            in++;
+            break;
+        }
+
+        if (*in == quote) {
+            quote = 0;
+        } else if (quote == 0 && (*in == '"' || *in == '\'')) {
+            quote = *in;
+        } else if (*in == '\\' && quote != '\'' && in[1] != '\0') {
+            *out++ = *++in;
+        } else {
+            *out++ = *in;
+        }
+    }
+
+    *out = '\0';
+    *rest = in;
+
+    return token;
+}
+
+void handleMessage(const char *message)
+{
+    char *tmpstr = strdup(message);
+    char *rest = tmpstr;
+
+    char *token = nextToken(&rest);
+
+    while (token != 0) {
+        char *command = strdup(token);
+
+        if (MESSAGE(command, "help")) {
+            messageRespond("wallfade messages:\n");
+            messageRespond("\tcurrent : display current wallpapers\n");
+            messageRespond("\tnext    : force wallfade to change wallpapers\n");
+            messageRespond("\tfade    : set fade time\n");
+            messageRespond("\tidle    : set idle time\n");
+            messageRespond("\tsmooth  : change smoothfunction\n");
+            messageRespond("\tpaths   : change paths\n");
+            messageRespond("\tprevious: fade back to the previous wallpapers\n");
+            messageRespond("\tgoto    : fade to the given wallpaper\n");
+            messageRespond("\tconfig  : print current config\n");
+            messageRespond("\tstats   : print texture cache usage\n");
+            messageRespond("\tsubscribe: stream events until disconnected\n");
+            messageRespond("\tqueue   : queue wallpapers for a monitor\n");
+            messageRespond("\tpreload : decode queued wallpapers ahead of time\n");
+            messageRespond("\torder   : random, sequential, sorted or shuffle\n");
+            messageRespond("\tthumbnail: cache a thumbnail, <path> <size>\n");
+            messageRespond("\tthumbnails: cache thumbnails, <size> <path>...\n");
+            messageRespond("\tquote paths with spaces: goto \"/a b.jpg\"\n");
+            break;
+        } else if (MESSAGE(command, "current")) {
+            for (int i = 0; i < settings.nmon; i++) {
+                messageRespond(
+                    "Monitor %d: %s\n",
+                    i,
+                    settings.planes[i].front_path
+                );
+            }
+        } else if (MESSAGE(command, "paths")) {
+            token = nextToken(&rest);
+
+            if (token != 0) {
+                for (int i = 0; i < settings.nmon; i++) {
+                    memset(settings.paths[i].path, 0, PATH_MAX);
+                }
+
+                if (parsePaths(token, messageRespond)) {
+                    settings.overrides |= OVERRIDE_PATHS;
+                    emitEvent("config paths %s\n", token);
+                }
+
+                for (int i = 0; i < settings.nmon; i++) {
+                    clearLookahead(i);
+                }
+            } else {
+                for (int i = 0; i < settings.nmon; i++) {
+                    messageRespond(
+                        "Monitor %d: %s\n",
+                        i,
+                        strlen(settings.paths[i].path) > 0 ?
+                        settings.paths[i].path :
+                        settings.default_path
+                    );
+                }
+            }
+
+            break;
+        } else if (MESSAGE(command, "next")) {
+            startFade();
+
+            messageRespond("forcing next wallpapers\n");
+        } else if (MESSAGE(command, "fade")) {
+            token = nextToken(&rest);
+
+            if (token != 0 && isdigit(token[0])) {
+                settings.fade = 1.0f / strtof(token, 0);
+                settings.overrides |= OVERRIDE_FADE;
+                messageRespond("setting %s to %s\n", command, token);
+                emitEvent("config %s %s\n", command, token);
+            } else {
+                messageRespond(
+                    "%s is set to %.2f\n",
+                    command,
+                    1.0f / settings.fade
+                );
+                break;
+            }
+        } else if (MESSAGE(command, "idle")) {
+            token = nextToken(&rest);
+
+            if (token != 0 && isdigit(token[0])) {
+                settings.idle = strtol(token, 0, 10);
+                settings.overrides |= OVERRIDE_IDLE;
+                messageRespond("setting %s to %s\n", command, token);
+                emitEvent("config %s %s\n", command, token);
+            } else {
+                messageRespond(
+                    "%s is set to %d\n",
+                    command,
+                    settings.idle
+                );
+                break;
+            }
+        } else if (MESSAGE(command, "smooth")) {
+            token = nextToken(&rest);
+
+            if (token != 0 && isdigit(token[0])) {
+                settings.smoothfunction = strtol(token, 0, 10);
+                settings.overrides |= OVERRIDE_SMOOTH;
+                messageRespond("setting %s to %s\n", command, token);
+                emitEvent("config %s %s\n", command, token);
+            } else {
+                messageRespond(
+                    "%s is set to %d\n",
+                    command,
+                    settings.smoothfunction
+                );
+                break;
+            }
+        } else if (MESSAGE(command, "previous")) {
+            if (settings.fading) {
+                messageRespond("fade in progress, try again\n");
+            } else if (previousImages()) {
+                messageRespond("fading to previous wallpapers\n");
+            } else {
+                messageRespond("no previous wallpapers\n");
+            }
+        } else if (MESSAGE(command, "goto")) {
+            token = nextToken(&rest);
+
+            // The daemon's working directory means nothing to the client.
+            if (token != 0 && token[0] != '/') {
+                messageRespond("%s is not an absolute path\n", token);
+                break;
+            }
+
+            char *file = token ? realpath(token, NULL) : NULL;
+
+            if (file == NULL) {
+                messageRespond("goto needs an existing file\n");
+            } else if (!validImage(file)) {
+                messageRespond("%s is not an image\n", file);
+            } else if (settings.fading) {
+                messageRespond("fade in progress, try again\n");
+            } else {
+                gotoImage(file);
+                messageRespond("fading to %s\n", file);
+            }
+
+            free(file);
+            break;
+        } else if (MESSAGE(command, "config")) {
+            printConfig();
+        } else if (MESSAGE(command, "stats")) {
+            printStats();
+        } else if (MESSAGE(command, "queue")) {
+            token = nextToken(&rest);
+
+            if (token == 0) {
+                for (int i = 0; i < settings.nmon; i++) {
+                    struct Playlist *playlist = &settings.playlists[i];
+
+                    for (int j = 0; j < playlist->count; j++) {
+                        messageRespond(
+                            "Monitor %d: %s%s\n",
+                            i,
+                            playlist->entries[j],
+                            j < playlist->queued ? "" : " (preload)"
+                        );
+                    }
+                }
+
+                break;
+            }
+
+            int monitor = strtol(token, 0, 10);
+
+            if (!isdigit(token[0]) || monitor >= settings.nmon) {
+                messageRespond("Monitor %s not found\n", token);
+                break;
+            }
+
+            int queued = 0;
+
+            while ((token = nextToken(&rest)) != 0) {
+                if (token[0] != '/') {
+                    messageRespond(
+                        "Skipping %s, not an absolute path\n",
+                        token
+                    );
+                    continue;
+                }
+
+                char *file = realpath(token, NULL);
+
+                if (file == NULL) {
+                    messageRespond("Skipping %s, not found\n", token);
+                    continue;
+                }
+
+                if (!validImage(file)) {
+                    messageRespond("Skipping %s, not an image\n", file);
+                    free(file);
+                    continue;
+                }
+
+                queuePath(monitor, file, true);
+                free(file);
+                queued++;
+            }
+
+            queueNext(monitor);
+
+            messageRespond("queued %d files on monitor %d\n", queued, monitor);
+            break;
+        } else if (MESSAGE(command, "preload")) {
+            int decoded = 0;
+
+            for (int i = 0; i < (settings.span ? 1 : settings.nmon); i++) {
+                decoded += preloadImages(i);
+            }
+
+            messageRespond("preloading %d wallpapers\n", decoded);
+        } else if (MESSAGE(command, "order")) {
+            token = nextToken(&rest);
+
+            if (token != 0 && parseOrder(token) >= 0) {
+                settings.order = parseOrder(token);
+                settings.overrides |= OVERRIDE_ORDER;
+
+                for (int i = 0; settings.index && i < settings.nmon; i++) {
+                    cleanFiles(&settings.index[i]);
+                    clearLookahead(i);
+                }
+
+                messageRespond("setting %s to %s\n", command, token);
+                emitEvent("config %s %s\n", command, token);
+            } else {
+                messageRespond(
+                    "%s is set to %s\n",
+                    command,
+                    orderName(settings.order)
+                );
+                break;
+            }
+        } else if (
+            MESSAGE(command, "thumbnail") ||
+            MESSAGE(command, "thumbnails")
+        ) {
+            bool bulk = MESSAGE(command, "thumbnails");
+            char *path = bulk ? NULL : nextToken(&rest);
+            char *size = nextToken(&rest);
+            int width = 0;
+            int height = 0;
+
+            if (size != NULL && sscanf(size, "%dx%d", &width, &height) == 1) {
+                height = width;
+            }
+
+            if (
+                (!bulk && path == NULL) ||
+                width <= 0 || width > THUMB_MAX ||
+                height <= 0 || height > THUMB_MAX
+            ) {
+                messageRespond(
+                    "%s needs a size up to %d\n",
+                    command,
+                    THUMB_MAX
+                );
+                break;
+            }
+
+            if (!bulk) {
+                thumbPush(settings.client, path, width, height);
+            }
+
+            while (bulk && (token = nextToken(&rest)) != 0) {
+                thumbPush(settings.client, token, width, height);
+            }
+
+            // Stays open until the workers answered every miss.
+            if (settings.client != NULL && settings.client->thumbs > 0) {
+                settings.client->done = false;
+            }
+
+            break;
+        } else if (MESSAGE(command, "subscribe")) {
+            if (settings.client != NULL) {
+                settings.client->done = false;
+                settings.client->subscribed = true;
+            }
+
+            break;
+        } else {
+            messageRespond("Unknown command \"%s\"\n", token);
+            break;
+        }
+
+        if (command) {
+            free(command);
+        }
+
+        token = nextToken(&rest);
+    }
+
+    if (tmpstr) {
+        free(tmpstr);
+    }
+}
+
+void displayName(char *name, size_t size)
+{
+    const char *env = getenv("DISPLAY");
+
+    snprintf(name, size, "%s", env ? env : "");
+
+    for (char *c = name; *c; c++) {
+        if (*c == '/') {
+            *c = '_';
+        }
+    }
+}
+
+bool privateDir(const char *dir)
+{
+    struct stat st;
+
+    if (mkdir(dir, S_IRWXU) != 0 && errno != EEXIST) {
+        fprintf(stderr, "Unable to create %s: %s\n", dir, strerror(errno));
+        return false;
+    }
+
+    // Anyone can create it first in /tmp, only trust our own 0700 directory.
+    if (
+        lstat(dir, &st) != 0 ||
+        !S_ISDIR(st.st_mode) ||
+        st.st_uid != getuid() ||
+        (st.st_mode & (S_IRWXG | S_IRWXO)) != 0
+    ) {
+        fprintf(stderr, "%s is not a private directory\n", dir);
+        return false;
+    }
+
+    return true;
+}
+
+bool getInstancePath(char *path, size_t size, const char *ext)
+{
+    char display[64];
+
+    displayName(display, sizeof(display));
+
+    const char *runtime = getenv("XDG_RUNTIME_DIR");
+
+    if (runtime != NULL && runtime[0] != '\0') {
+        snprintf(path, size, "%s/wallfade-%s.%s", runtime, display, ext);
+        return true;
+    }
+
+    char dir[64];
+
+    snprintf(dir, sizeof(dir), "/tmp/wallfade-%d", (int)getuid());
+
+    if (!privateDir(dir)) {
+        return false;
+    }
+
+    snprintf(path, size, "%s/%s.%s", dir, display, ext);
+
+    return true;
+}
+
+bool getSocketPath(char *path)
+{
+    return getInstancePath(path, SOCKET_PATH_MAX, "sock");
+}
+
+int lockInstance()
+{
+    char path[PATH_MAX];
+
+    if (!getInstancePath(path, sizeof(path), "lock")) {
+        return -1;
+    }
+
+    int fd = open(
+                 path,
+                 O_RDWR | O_CREAT | O_CLOEXEC | O_NOFOLLOW,
+                 S_IRUSR | S_IWUSR
+             );
+
+    if (fd < 0) {
+        fprintf(stderr, "Unable to open %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    if (flock(fd, LOCK_EX | LOCK_NB) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+int connectSocket()
+{
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+
+    if (!getSocketPath(addr.sun_path)) {
+        return -1;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+    if (fd < 0) {
+        return -1;
+    }
+
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+char *absoluteMessage(const char *message)
+{
+    char *output = NULL;
+    size_t size = 0;
+    FILE *out = open_memstream(&output, &size);
+
+    if (out == NULL) {
+        return strdup(message);
+    }
+
+    char cwd[PATH_MAX];
+
+    // Relative paths are left alone, the daemon refuses them.
+    if (getcwd(cwd, sizeof(cwd)) == NULL) {
+        cwd[0] = '\0';
+    }
+
+    char *tmpstr = strdup(message);
+    char *rest = tmpstr;
+    char *token;
+    int skip = -1;
+    int paths = 0;
+
+    // Only the path arguments change, every token goes back quoted.
+    while ((token = nextToken(&rest)) != NULL) {
+        bool path = false;
+
+        if (skip > 0) {
+            skip--;
+        } else if (skip == 0 && paths != 0) {
+            path = true;
+            paths--;
+        } else if (MESSAGE(token, "goto") || MESSAGE(token, "thumbnail")) {
+            skip = 0;
+            paths = 1;
+        } else if (MESSAGE(token, "queue") || MESSAGE(token, "thumbnails")) {
+            // A monitor or a size comes first, every token after is a path.
+            skip = 1;
+            paths = -1;
+        }
+
+        fputs(ftell(out) > 0 ? " \"" : "\"", out);
+
+        if (path && token[0] != '/' && cwd[0] != '\0') {
+            fprintf(out, "%s/", strcmp(cwd, "/") ? cwd : "");
+        }
+
+        for (const char *c = token; *c != '\0'; c++) {
+            if (*c == '"' || *c == '\\') {
+                fputc('\\', out);
+            }
+
+            fputc(*c, out);
+        }
+
+        fputc('"', out);
+    }
+
+    fclose(out);
+    free(tmpstr);
+
+    return output;
+}
+
+int sendMessage(const char *message)
+{
+    int fd = connectSocket();
+
+    if (fd < 0) {
+        fprintf(stderr, "No wallfade process found!\n");
+        return EXIT_FAILURE;
+    }
+
+    char *line = absoluteMessage(message);
+    size_t len = strlen(line);
+
+    if (
+        write(fd, line, len) != (ssize_t)len ||
+        write(fd, "\n", 1) != 1
+    ) {
+        fprintf(stderr, "Unable to send message: %s\n", strerror(errno));
+        free(line);
+        close(fd);
+
+        return EXIT_FAILURE;
+    }
+
+    free(line);
+
+    shutdown(fd, SHUT_WR);
+
+    char buffer[BUFSIZ];
+    ssize_t n;
+
+    while ((n = read(fd, buffer, sizeof(buffer))) > 0) {
+        fwrite(buffer, 1, n, stdout);
+        fflush(stdout);
+    }
+
+    close(fd);
+
+    return EXIT_SUCCESS;
+}
+
+bool watchFd(int fd, uint32_t events, void *ptr, int op)
+{
+    struct epoll_event ev = { .events = events, .data.ptr = ptr };
+    return epoll_ctl(settings.epoll, op, fd, &ev) == 0;
+}
+
+bool startServer()
+{
+    settings.epoll = epoll_create1(EPOLL_CLOEXEC);
+
+    if (settings.epoll < 0) {
+        fprintf(stderr, "Unable to create epoll: %s\n", strerror(errno));
+        return false;
+    }
+
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+
+    if (!getSocketPath(addr.sun_path)) {
+        return false;
+    }
+
+    // We hold the instance lock, anything still there is from a crash.
+    unlink(addr.sun_path);
+
+    settings.server = socket(
+                          AF_UNIX,
+                          SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                          0
+                      );
+
+    // The socket is created 0600, nobody else can connect in between.
+    mode_t mask = umask(S_IRWXG | S_IRWXO | S_IXUSR);
+
+    bool ok = (
+                  settings.server >= 0 &&
+                  bind(
+                      settings.server,
+                      (struct sockaddr *)&addr,
+                      sizeof(addr)
+                  ) == 0 &&
+                  listen(settings.server, SOMAXCONN) == 0
+              );
+
+    umask(mask);
+
+    if (!ok) {
+        fprintf(
+            stderr,
+            "Unable to listen on %s: %s\n",
+            addr.sun_path,
+            strerror(errno)
+        );
+        return false;
+    }
+
+    return watchFd(settings.server, EPOLLIN, &settings.server, EPOLL_CTL_ADD);
+}
+
+void stopServer()
+{
+    while (settings.clients != NULL) {
+        clientClose(settings.clients);
+    }
+
+    clientReap();
+
+    if (settings.server >= 0) {
+        char path[SOCKET_PATH_MAX];
+
+        close(settings.server);
+
+        if (getSocketPath(path)) {
+            unlink(path);
+        }
+    }
+
+    if (settings.inotify >= 0) {
+        close(settings.inotify);
+    }
+
+    if (settings.epoll >= 0) {
+        close(settings.epoll);
+    }
+}
+
+void clientAccept()
+{
+    int fd;
+
+    while ((fd = accept4(
+                     settings.server,
+                     NULL,
+                     NULL,
+                     SOCK_NONBLOCK | SOCK_CLOEXEC
+                 )) >= 0) {
+        struct ucred cred;
+        socklen_t len = sizeof(cred);
+
+        // Only our own user may drive the daemon.
+        if (
+            getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) != 0 ||
+            cred.uid != getuid()
+        ) {
+            close(fd);
+            continue;
+        }
+
+        struct Client *client = calloc(1, sizeof(struct Client));
+        client->fd = fd;
+
+        if (!watchFd(fd, EPOLLIN, client, EPOLL_CTL_ADD)) {
+            close(fd);
+            free(client);
+            continue;
+        }
+
+        client->next = settings.clients;
+        settings.clients = client;
+    }
+}
+
+void clientClose(struct Client *client)
+{
+    struct Client **it = &settings.clients;
+
+    if (client->closed) {
+        return;
+    }
+
+    while (*it != NULL && *it != client) {
+        it = &(*it)->next;
+    }
+
+    if (*it != NULL) {
+        *it = client->next;
+    }
+
+    if (settings.client == client) {
+        settings.client = NULL;
+    }
+
+    decodeForget(client);
+
+    epoll_ctl(settings.epoll, EPOLL_CTL_DEL, client->fd, NULL);
+    close(client->fd);
+
+    // Pending epoll events may still point at it, see clientReap.
+    client->closed = true;
+    client->next = settings.closed;
+    settings.closed = client;
+}
+
+void clientReap()
+{
+    while (settings.closed != NULL) {
+        struct Client *client = settings.closed;
+
+        settings.closed = client->next;
+
+        free(client->in);
+        free(client->out);
+        free(client);
+    }
+}
+
+void clientWrite(struct Client *client, const char *data, size_t len)
+{
+    if (client->out_len + len > client->out_size) {
+        client->out_size = (client->out_len + len) * 2;
+        client->out = realloc(client->out, client->out_size);
+    }
+
+    memcpy(client->out + client->out_len, data, len);
+    client->out_len += len;
+}
+
+bool clientFlush(struct Client *client)
+{
+    if (client->closed) {
+        return false;
+    }
+
+    while (client->out_pos < client->out_len) {
+        ssize_t n = send(
+                        client->fd,
+                        client->out + client->out_pos,
+                        client->out_len - client->out_pos,
+                        MSG_NOSIGNAL
+                    );
+
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                watchFd(client->fd, EPOLLOUT, client, EPOLL_CTL_MOD);
+                return true;
+            }
+
+            clientClose(client);
+            return false;
+        }
+
+        client->out_pos += n;
+    }
+
+    client->out_pos = 0;
+    client->out_len = 0;
+
+    if (client->done) {
+        clientClose(client);
+        return false;
+    }
+
+    // Subscribers and thumbnail requests only get written to, a write
+    // error tells us they left.
+    watchFd(
+        client->fd,
+        client->subscribed || client->thumbs > 0 ? 0 : EPOLLIN,
+        client,
+        EPOLL_CTL_MOD
+    );
+    return true;
+}
+
+int emitEvent(const char *format, ...)
+{
+    char line[PATH_MAX + 64];
+
+    va_list args;
+    va_start(args, format);
+    int len = vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+
+    if (len < 0) {
+        return len;
+    }
+
+    if (len >= (int)sizeof(line)) {
+        len = sizeof(line) - 1;
+        line[len - 1] = '\n';
+    }
+
+    struct Client *client = settings.clients;
+
+    while (client != NULL) {
+        struct Client *next = client->next;
+
+        if (client->subscribed && client->out_len > MAX_MESSAGE) {
+            // Not reading its events, drop it rather than buffer forever.
+            clientClose(client);
+        } else if (client->subscribed) {
+            clientWrite(client, line, len);
+            clientFlush(client);
+        }
+
+        client = next;
+    }
+
+    return len;
+}
+
+void clientRead(struct Client *client)
+{
+    char buffer[BUFSIZ];
+    ssize_t n;
+
+    while ((n = read(client->fd, buffer, sizeof(buffer))) != 0) {
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+
+            clientClose(client);
+            return;
+        }
+
+        if (client->in_len + n + 1 > MAX_MESSAGE) {
+            clientClose(client);
+            return;
+        }
+
+        client->in = realloc(client->in, client->in_len + n + 1);
+        memcpy(client->in + client->in_len, buffer, n);
+        client->in_len += n;
+        client->in[client->in_len] = '\0';
+    }
+
+    bool eof = (n == 0);
+
+    char *newline = client->in ? strchr(client->in, '\n') : NULL;
+
+    if (newline == NULL && !eof) {
+        return;
+    }
+
+    if (newline != NULL) {
+        *newline = '\0';
+    }
+
+    // One command line per connection, the answer ends with EOF.
+    client->done = true;
+
+    if (client->in != NULL && client->in[0] != '\0') {
+        settings.client = client;
+        handleMessage(client->in);
+        settings.client = NULL;
+    }
+
+    clientFlush(client);
+}
+
+void waitEvents(int timeout)
+{
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    int remaining = timeout;
+
+    do {
+        struct epoll_event events[16];
+        int n = epoll_wait(settings.epoll, events, 16, remaining);
+
+        for (int i = 0; i < n; i++) {
+            void *ptr = events[i].data.ptr;
+
+            if (ptr == &settings.server) {
+                clientAccept();
+            } else if (ptr == &settings.inotify) {
+                configChanged();
+            } else if (ptr == &settings.xfd) {
+                // Let update() pick up the X events right away.
+                clientReap();
+                return;
+            } else {
+                struct Client *client = ptr;
+
+                // Closed by an earlier handler in this batch.
+                if (client->closed) {
+                    continue;
+                }
+
+                if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+                    if (!(events[i].events & EPOLLIN)) {
+                        clientClose(client);
+                        continue;
+                    }
+                }
+
+                if (events[i].events & EPOLLOUT) {
+                    clientFlush(client);
+                } else if (events[i].events & EPOLLIN) {
+                    clientRead(client);
+                }
+            }
+        }
+
+        clientReap();
+
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+
+        int elapsed = (now.tv_sec - start.tv_sec) * 1000 +
+                      (now.tv_nsec - start.tv_nsec) / 1000000;
+
+        remaining = timeout - elapsed;
+    } while (remaining > 0 && settings.running);
+}
+
+void startFade()
+{
+    if (!settings.fade_queued) {
+        clock_gettime(CLOCK_MONOTONIC, &settings.queued);
+    }
+
+    for (int i = 0; i < settings.nmon; i++) {
+        if (settings.planes[i].pending) {
+            settings.fade_queued = true;
+            return;
+        }
+    }
+
+    settings.fade_queued = false;
+
+    if (!settings.fading) {
+        // How long the wall waited on its slowest decode.
+        settings.transition = secondsSince(&settings.queued);
+        settings.transition_max = fmaxf(
+                                      settings.transition_max,
+                                      settings.transition
+                                  );
+        settings.transitions++;
+
+        emitEvent("fade start\n");
+    }
+
+    settings.fading = true;
+    settings.timer = 0;
+}
+
+double secondsSince(const struct timespec *since)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (now.tv_sec - since->tv_sec) +
+           (now.tv_nsec - since->tv_nsec) / 1e9;
+}
+
+void update()
+{
+    processEvents();
+    checkPower();
+
+    if (!isVisible()) {
+        if (!settings.suspended) {
+            printf("Output not visible, suspending\n");
+            settings.suspended = true;
+        }
+
+        // Nobody can see us, skip drawing and keep the idle timer (and with
+        // it the next decode) frozen until we are visible again.
+        settings.seconds = getDeltaTime();
+        decodeCollect();
+        indexCollect();
+        waitEvents(250);
+
+        return;
+    }
+
+    if (settings.suspended) {
+        printf("Output visible, resuming\n");
+        settings.suspended = false;
+        settings.seconds = getDeltaTime();
+    }
+
+    float next_frame = -1.0f;
+
+    for (int i = 0; i < settings.nmon; i++) {
+        // Hidden behind a fullscreen window, the animation can wait.
+        if (settings.planes[i].covered) {
+            continue;
+        }
+
+        float wait = animationTick(&settings.planes[i]);
+
+        if (wait >= 0.0f && (next_frame < 0.0f || wait < next_frame)) {
+            next_frame = wait;
+        }
+    }
+
+    float alpha = fadeStep();
+
+    // Contexts cannot share textures across screens, each head draws its own.
+    for (int i = 0; i < settings.nheads; i++) {
+        if (headCovered(i)) {
+            continue;
+        }
+
+        useHead(i);
+
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+        glMatrixMode(GL_MODELVIEW);
+        glLoadIdentity();
+
+        drawPlanes(alpha);
+
+        glXSwapBuffers(settings.dpy, settings.win);
+    }
+
+    if (settings.startup == 0) {
+        bool shown = true;
+
+        for (int i = 0; i < settings.nmon; i++) {
+            shown &= settings.planes[i].front != 0;
+        }
+
+        if (shown) {
+            settings.startup = secondsSince(&settings.started);
+            printf("Started in %.2f s\n", settings.startup);
+        }
+    }
+
+    XFlush(settings.dpy);
+
+    settings.seconds = getDeltaTime();
+
+    decodeCollect();
+    indexCollect();
+
+    if (settings.timer >= settings.idle || settings.fade_queued) {
+        startFade();
+    }
+
+    int delay = 50000;
+
+    if (!settings.fading) {
+        settings.timer += settings.seconds;
+        delay += 50000;
+    }
+
+    if (next_frame >= 0.0f && next_frame * 1000000 < delay) {
+        delay = fmaxf(next_frame * 1000000, 1000);
+    }
+
+    waitEvents(delay / 1000);
+}
+
+const char *orderName(int order)
+{
+    switch (order) {
+        case ORDER_SEQUENTIAL:
+            return "sequential";
+
+        case ORDER_SORTED:
+            return "sorted";
+
+        case ORDER_SHUFFLE:
+            return "shuffle";
+
+        default:
+            return "random";
+    }
+}
+
+int parseOrder(const char *name)
+{
+    for (int order = ORDER_RANDOM; order <= ORDER_SHUFFLE; order++) {
+        if (!strcmp(name, orderName(order))) {
+            return order;
+        }
+    }
+
+    return -1;
+}
+
+const char *filterName(int filter)
+{
+    switch (filter) {
+        case PointFilter:
+            return "point";
+
+        case BoxFilter:
+            return "box";
+
+        case TriangleFilter:
+            return "bilinear";
+
+        case CatromFilter:
+            return "catrom";
+
+        case MitchellFilter:
+            return "mitchell";
+
+        case LanczosFilter:
+            return "lanczos";
+
+        case GaussianFilter:
+            return "gaussian";
+
+        default:
+            return "none";
+    }
+}
+
+int parseFilter(const char *name, int fallback)
+{
+    const int filters[] = {
+        UndefinedFilter,
+        PointFilter,
+        BoxFilter,
+        TriangleFilter,
+        CatromFilter,
+        MitchellFilter,
+        LanczosFilter,
+        GaussianFilter
+    };
+
+    for (size_t i = 0; i < sizeof(filters) / sizeof(filters[0]); i++) {
+        if (!strcasecmp(name, filterName(filters[i]))) {
+            return filters[i];
+        }
+    }
+
+    fprintf(stderr, "Unknown filter %s, using %s\n", name, filterName(fallback));
+
+    return fallback;
+}
+
+int compareName(const void *a, const void *b)
+{
+    return strcmp(
+               ((const struct IndexEntry *)a)->path,
+               ((const struct IndexEntry *)b)->path
+           );
+}
+
+int compareMtime(const void *a, const void *b)
+{
+    time_t ma = ((const struct IndexEntry *)a)->mtime;
+    time_t mb = ((const struct IndexEntry *)b)->mtime;
+
+    return (ma > mb) - (ma < mb);
+}
+
+bool patternTime(const char *pattern, struct timespec *mtime)
+{
+    char dir[PATH_MAX];
+
+    if (!strncmp(pattern, "~/", 2)) {
+        snprintf(dir, sizeof(dir), "%s%s", getHomeDir(), pattern + 1);
+    } else {
+        sprintf(dir, "%.*s", PATH_MAX - 1, pattern);
+    }
+
+    char *slash = strrchr(dir, '/');
+
+    if (slash == NULL) {
+        return false;
+    }
+
+    *slash = '\0';
+
+    // Wildcards in the directory part, a new file could be anywhere.
+    if (strpbrk(dir, "*?[{") != NULL) {
+        return false;
+    }
+
+    struct stat st;
+
+    if (stat(dir, &st) != 0) {
+        return false;
+    }
+
+    *mtime = st.st_mtim;
+
+    return true;
+}
+
+bool indexStale(struct Index *index, const char *pattern)
+{
+    struct timespec mtime;
+
+    return (
+        strcmp(index->pattern, pattern) ||
+        !patternTime(pattern, &mtime) ||
+        mtime.tv_sec != index->mtime.tv_sec ||
+        mtime.tv_nsec != index->mtime.tv_nsec
+    );
+}
+
+struct Index *getFiles(int monitor)
+{
+    if (settings.index == NULL) {
+        settings.index = calloc(settings.nmon, sizeof(struct Index));
+    }
+
+    struct Index *index = &settings.index[monitor];
+    const char *pattern = settings.paths[monitor].path;
+
+    // The paths changed under a rescan, its result is of no use.
+    if (index->scan != NULL && strcmp(index->scan->pattern, pattern)) {
+        indexAbandon(index->scan);
+        index->scan = NULL;
+    }
+
+    if (index->scan != NULL || !indexStale(index, pattern)) {
+        return index;
+    }
+
+    struct IndexScan *scan = calloc(1, sizeof(struct IndexScan));
+
+    sprintf(scan->pattern, "%.*s", PATH_MAX - 1, pattern);
+    scan->order = settings.order;
+    scan->lower = true;
+
+    // Only a directory that changed under a known pattern is rescanned in
+    // the background, a new pattern has nothing to serve in the meantime.
+    bool rescan = index->nfiles > 0 && !strcmp(index->pattern, pattern);
+
+    if (rescan && pthread_create(&scan->thread, NULL, indexWorker, scan) == 0) {
+        index->scan = scan;
+        return index;
+    }
+
+    // On this thread the OpenMP team must keep the render priority.
+    scan->lower = false;
+    indexRun(scan);
+    indexSwap(monitor, scan);
+
+    return index;
+}
+
+void *indexWorker(void *arg)
+{
+    struct IndexScan *scan = arg;
+
+    indexRun(scan);
+
+    // Nobody waits for an abandoned scan, it cleans up after itself.
+    if (atomic_exchange(&scan->state, SCAN_DONE) == SCAN_ABANDONED) {
+        for (int i = 0; i < scan->nfiles; i++) {
+            free(scan->entries[i].path);
+        }
+
+        free(scan->entries);
+        free(scan);
+    }
+
+    return NULL;
+}
+
+void indexRun(struct IndexScan *scan)
+{
+    // Stamped before the glob, a file added meanwhile triggers a rescan.
+    patternTime(scan->pattern, &scan->mtime);
+
+    glob_t globbuf;
+
+    if (glob(scan->pattern, GLOB_BRACE | GLOB_TILDE, NULL, &globbuf) != 0) {
+        return;
+    }
+
+    scan->paths = globbuf.gl_pathv;
+    scan->count = globbuf.gl_pathc;
+    scan->entries = calloc(scan->count, sizeof(struct IndexEntry));
+
+    indexScan(scan);
+
+    for (size_t i = 0; i < scan->count; i++) {
+        if (scan->entries[i].path != NULL) {
+            scan->entries[scan->nfiles++] = scan->entries[i];
+        }
+    }
+
+    scan->paths = NULL;
+    globfree(&globbuf);
+
+    if (scan->order == ORDER_SEQUENTIAL) {
+        qsort(scan->entries, scan->nfiles, sizeof(struct IndexEntry),
+              compareMtime);
+    } else if (scan->order == ORDER_SORTED) {
+        qsort(scan->entries, scan->nfiles, sizeof(struct IndexEntry),
+              compareName);
+    }
+}
+
+void indexScan(struct IndexScan *scan)
+{
+    size_t i;
+
+    #pragma omp parallel private(i)
+    {
+        if (scan->lower) {
+            lowerPriority();
+        }
+
+        #pragma omp for
+
+        for (i = 0; i < scan->count; i++) {
+            char *file = realpath(scan->paths[i], NULL);
+
+            if (file == NULL) {
+                fprintf(
+                    stderr,
+                    "Unable to resolve realpath for %s",
+                    scan->paths[i]
+                );
+            } else {
+                struct stat fst;
+
+                if (stat(file, &fst) == 0) {
+                    scan->entries[i].mtime = fst.st_mtime;
+                }
+
+                scan->entries[i].path = file;
+            }
+        }
+    }
+}
+
+void indexSwap(int monitor, struct IndexScan *scan)
+{
+    struct Index *index = &settings.index[monitor];
+
+    index->scan = NULL;
+    cleanFiles(index);
+
+    sprintf(index->pattern, "%.*s", PATH_MAX - 1, scan->pattern);
+    index->mtime = scan->mtime;
+    index->entries = scan->entries;
+    index->nfiles = scan->nfiles;
+
+    settings.nfiles[monitor] = index->nfiles;
+
+    free(scan);
+}
+
+void indexAbandon(struct IndexScan *scan)
+{
+    if (atomic_exchange(&scan->state, SCAN_ABANDONED) == SCAN_RUNNING) {
+        pthread_detach(scan->thread);
+        return;
+    }
+
+    pthread_join(scan->thread, NULL);
+
+    for (int i = 0; i < scan->nfiles; i++) {
+        free(scan->entries[i].path);
+    }
+
+    free(scan->entries);
+    free(scan);
+}
+
+void indexCollect()
+{
+    for (int i = 0; settings.index && i < settings.nmon; i++) {
+        struct IndexScan *scan = settings.index[i].scan;
+
+        if (scan != NULL && atomic_load(&scan->state) == SCAN_DONE) {
+            pthread_join(scan->thread, NULL);
+            indexSwap(i, scan);
+        }
+    }
+}
+
+void cleanFiles(struct Index *index)
+{
+    if (index->scan != NULL) {
+        indexAbandon(index->scan);
+    }
+
+    for (int i = 0; i < index->nfiles; i++) {
+        free(index->entries[i].path);
+    }
+
+    free(index->entries);
+    free(index->shuffle);
+
+    memset(index, 0, sizeof(struct Index));
+}
+
+bool pickPath(int monitor, const char *not, char *path)
+{
+    struct Index *index = getFiles(monitor);
+    int nfiles = index->nfiles;
+    int usable = nfiles - index->nfailed;
+
+    // Nothing left that decodes, stop asking until the directory changes.
+    if (usable <= 0) {
+        return false;
+    }
+
+    int pick = 0;
+
+    switch (settings.order) {
+        case ORDER_SEQUENTIAL:
+        case ORDER_SORTED:
+            do {
+                index->pos %= nfiles;
+                pick = index->pos++;
+            } while (index->entries[pick].failed);
+
+            break;
+
+        case ORDER_SHUFFLE:
+            do {
+                if (index->shuffle == NULL || index->pos >= nfiles) {
+                    index->shuffle = realloc(
+                                         index->shuffle,
+                                         nfiles * sizeof(int)
+                                     );
+
+                    for (int i = 0; i < nfiles; i++) {
+                        index->shuffle[i] = i;
+                    }
+
+                    for (int i = nfiles - 1; i > 0; i--) {
+                        int j = random() % (i + 1);
+                        int tmp = index->shuffle[i];
+                        index->shuffle[i] = index->shuffle[j];
+                        index->shuffle[j] = tmp;
+                    }
+
+                    index->pos = 0;
+                }
+
+                pick = index->shuffle[index->pos++];
+            } while (index->entries[pick].failed);
+
+            break;
+
+        default:
+            do {
+                pick = random() % nfiles;
+            } while (
+                index->entries[pick].failed ||
+                (strcmp(index->entries[pick].path, not) == 0 && usable != 1)
+            );
+
+            break;
+    }
+
+    sprintf(path, "%.*s", PATH_MAX - 1, index->entries[pick].path);
+
+    return true;
+}
+
+void markFailed(int monitor, const char *path)
+{
+    if (settings.index == NULL) {
+        return;
+    }
+
+    struct Index *index = &settings.index[monitor];
+
+    for (int i = 0; i < index->nfiles; i++) {
+        if (!index->entries[i].failed && !strcmp(index->entries[i].path, path)) {
+            index->entries[i].failed = true;
+            index->nfailed++;
+        }
+    }
+}
+
+bool nextPath(int monitor, const char *not, char *path)
+{
+    struct Playlist *playlist = &settings.playlists[monitor];
+
+    // Keep nfiles in sync even when the playlist serves the image.
+    getFiles(monitor);
+
+    while (playlist->count > 0) {
+        sprintf(path, "%.*s", PATH_MAX - 1, playlist->entries[0]);
+
+        playlist->count--;
+        playlist->picked = playlist->queued > 0;
+
+        if (playlist->queued > 0) {
+            playlist->queued--;
+        }
+
+        memmove(
+            playlist->entries[0],
+            playlist->entries[1],
+            playlist->count * PATH_MAX
+        );
+
+        // Decoding a file stuck on the network would freeze the display.
+        if (prefetchReady(path)) {
+            return true;
+        }
+
+        fprintf(stderr, "Skipping %s, read stalled\n", path);
+    }
+
+    playlist->picked = false;
+
+    return pickPath(monitor, not, path);
+}
+
+void queuePath(int monitor, const char *path, bool queued)
+{
+    struct Playlist *playlist = &settings.playlists[monitor];
+
+    playlist->entries = realloc(
+                            playlist->entries,
+                            (playlist->count + 1) * PATH_MAX
+                        );
+
+    // Queued paths go ahead of the ones picked for preloading.
+    int at = queued ? playlist->queued++ : playlist->count;
+
+    memmove(
+        playlist->entries[at + 1],
+        playlist->entries[at],
+        (playlist->count - at) * PATH_MAX
+    );
+
+    sprintf(playlist->entries[at], "%.*s", PATH_MAX - 1, path);
+    playlist->count++;
+}
+
+void clearLookahead(int monitor)
+{
+    settings.playlists[monitor].count = settings.playlists[monitor].queued;
+}
+
+void queueNext(int monitor)
+{
+    struct Playlist *playlist = &settings.playlists[monitor];
+
+    // The back image was picked before anything was queued, swap it for
+    // the head of the queue while no fade is showing it yet.
+    if (
+        settings.fading ||
+        playlist->picked ||
+        playlist->queued == 0 ||
+        (settings.span && monitor != 0)
+    ) {
+        return;
+    }
+
+    for (int i = 0; i < settings.nmon; i++) {
+        struct Plane *plane = &settings.planes[i];
+
+        if (settings.span || i == monitor) {
+            cachePut(plane, plane->back, plane->back_path);
+            plane->back = 0;
+        }
+    }
+
+    if (settings.span) {
+        spanImage(false, settings.planes[0].front_path);
+    } else {
+        struct Plane *plane = &settings.planes[monitor];
+
+        randomImage(&plane->back, plane, plane->front_path, monitor);
+    }
+}
+
+void fillLookahead(int monitor, int count)
+{
+    struct Playlist *playlist = &settings.playlists[monitor];
+    struct Plane *plane = &settings.planes[monitor];
+
+    while (playlist->count < count) {
+        char path[PATH_MAX];
+        const char *last = playlist->count > 0 ?
+                           playlist->entries[playlist->count - 1] :
+                           plane->back_path;
+
+        if (!pickPath(monitor, last, path)) {
+            break;
+        }
+
+        queuePath(monitor, path, false);
+    }
+}
+
+int preloadImages(int monitor)
+{
+    struct Playlist *playlist = &settings.playlists[monitor];
+    struct Plane *plane = &settings.planes[monitor];
+    int decoded = 0;
+
+    fillLookahead(monitor, settings.preload);
+
+    // Explicitly queued entries are always worth decoding.
+    int count = playlist->queued > settings.preload ?
+                playlist->queued : settings.preload;
+
+    for (int i = 0; i < playlist->count && i < count; i++) {
+        const char *path = playlist->entries[i];
+
+        if (cacheHas(plane, path) || !strcmp(path, plane->back_path)) {
+            continue;
+        }
+
+        if (settings.span) {
+            spanPreload(path);
+        } else {
+            decodePush(monitor, path, false);
+        }
+
+        decoded++;
+    }
+
+    return decoded;
+}
+
+void prefetchImages(int monitor)
+{
+    struct Playlist *playlist = &settings.playlists[monitor];
+    struct Plane *plane = &settings.planes[monitor];
+
+    if (settings.prefetch <= 0) {
+        return;
+    }
+
+    fillLookahead(monitor, settings.prefetch);
+
+    for (int i = 0; i < playlist->count && i < settings.prefetch; i++) {
+        if (!cacheHas(plane, playlist->entries[i])) {
+            prefetchPush(playlist->entries[i]);
+        }
+    }
+}
+
+void prefetchPush(const char *path)
+{
+    struct Prefetch *pf = settings.prefetcher;
+
+    if (pf == NULL) {
+        // Never freed, a read stuck in the kernel may outlive cleanup().
+        pf = calloc(1, sizeof(struct Prefetch));
+
+        pthread_mutex_init(&pf->lock, NULL);
+        pthread_cond_init(&pf->cond, NULL);
+
+        if (pthread_create(&pf->thread, NULL, prefetchWorker, pf) != 0) {
+            free(pf);
+            return;
+        }
+
+        pthread_detach(pf->thread);
+        settings.prefetcher = pf;
+    }
+
+    pthread_mutex_lock(&pf->lock);
+
+    pf->rate = settings.prefetch_rate * 1048576.0;
+    pf->timeout = settings.prefetch_timeout;
+
+    bool known = !strcmp(pf->current, path);
+
+    for (int i = 0; i < pf->count; i++) {
+        known |= !strcmp(pf->queue[(pf->head + i) % PREFETCH_QUEUE], path);
+    }
+
+    if (!known && pf->count < PREFETCH_QUEUE) {
+        sprintf(
+            pf->queue[(pf->head + pf->count++) % PREFETCH_QUEUE],
+            "%.*s",
+            PATH_MAX - 1,
+            path
+        );
+
+        pthread_cond_signal(&pf->cond);
+    }
+
+    pthread_mutex_unlock(&pf->lock);
+}
+
+bool prefetchReady(const char *path)
+{
+    struct Prefetch *pf = settings.prefetcher;
+    bool ready = true;
+
+    if (pf == NULL) {
+        return true;
+    }
+
+    pthread_mutex_lock(&pf->lock);
+
+    // Stalls expire, the share may have come back since.
+    for (int i = 0; i < pf->nstalled && i < PREFETCH_QUEUE; i++) {
+        if (secondsSince(&pf->stalled_at[i]) < PREFETCH_RETRY) {
+            ready &= strcmp(pf->stalled[i], path) != 0;
+        }
+    }
+
+    // A read() that hangs never returns to notice its timeout, and
+    // whatever is queued behind it will not be read either.
+    bool stuck = pf->current[0] != '\0' &&
+                 pf->timeout > 0 &&
+                 secondsSince(&pf->since) > pf->timeout;
+
+    if (stuck) {
+        ready &= strcmp(pf->current, path) != 0;
+
+        for (int i = 0; i < pf->count; i++) {
+            ready &= strcmp(
+                         pf->queue[(pf->head + i) % PREFETCH_QUEUE],
+                         path
+                     ) != 0;
+        }
+    }
+
+    pthread_mutex_unlock(&pf->lock);
+
+    return ready;
+}
+
+bool prefetchFile(const char *path, unsigned char *buffer, double rate,
+                  double timeout)
+{
+    struct timespec start;
+    struct timespec now;
+    size_t total = 0;
+    ssize_t n;
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+    if (fd < 0) {
+        return true;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+
+    // The advice alone is not enough on NFS, reading pulls the pages in.
+    while ((n = read(fd, buffer, PREFETCH_CHUNK)) > 0) {
+        total += n;
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+
+        double elapsed = (now.tv_sec - start.tv_sec) +
+                         (now.tv_nsec - start.tv_nsec) / 1e9;
+
+        if (timeout > 0 && elapsed > timeout) {
+            close(fd);
+            return false;
+        }
+
+        if (rate > 0 && total / rate > elapsed) {
+            double ahead = total / rate - elapsed;
+            struct timespec pause = {
+                (time_t)ahead,
+                (long)((ahead - (time_t)ahead) * 1e9)
+            };
+
+            nanosleep(&pause, NULL);
+        }
+    }
+
+    close(fd);
+
+    return n == 0;
+}
+
+void *prefetchWorker(void *arg)
+{
+    struct Prefetch *pf = arg;
+    unsigned char *buffer = malloc(PREFETCH_CHUNK);
+    char path[PATH_MAX];
+
+    lowerPriority();
+
+    pthread_mutex_lock(&pf->lock);
+
+    while (true) {
+        while (pf->count == 0) {
+            pthread_cond_wait(&pf->cond, &pf->lock);
+        }
+
+        sprintf(path, "%s", pf->queue[pf->head]);
+        sprintf(pf->current, "%s", path);
+
+        pf->head = (pf->head + 1) % PREFETCH_QUEUE;
+        pf->count--;
+
+        clock_gettime(CLOCK_MONOTONIC, &pf->since);
+
+        double rate = pf->rate;
+        double timeout = pf->timeout;
+
+        pthread_mutex_unlock(&pf->lock);
+
+        bool ok = prefetchFile(path, buffer, rate, timeout);
+
+        pthread_mutex_lock(&pf->lock);
+
+        if (!ok) {
+            fprintf(stderr, "Prefetch of %s stalled, skipping it\n", path);
+
+            int slot = pf->nstalled++ % PREFETCH_QUEUE;
+
+            sprintf(pf->stalled[slot], "%s", path);
+            clock_gettime(CLOCK_MONOTONIC, &pf->stalled_at[slot]);
+        } else {
+            for (int i = 0; i < pf->nstalled && i < PREFETCH_QUEUE; i++) {
+                if (!strcmp(pf->stalled[i], path)) {
+                    pf->stalled[i][0] = '\0';
+                }
+            }
+        }
+
+        pf->current[0] = '\0';
+    }
+
+    return NULL;
+}
+
+void lowerPriority()
+{
+    struct sched_param param = { 0 };
+    pid_t tid = syscall(SYS_gettid);
+
+    // Only the calling thread, the render thread keeps its priority.
+    if (pthread_setschedparam(pthread_self(), SCHED_IDLE, &param) != 0) {
+        setpriority(PRIO_PROCESS, tid, 19);
+    }
+
+    syscall(
+        SYS_ioprio_set,
+        IOPRIO_WHO_PROCESS,
+        tid,
+        IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT
+    );
+}
+
+struct Decoder *decodeStart()
+{
+    struct Decoder *dec = settings.decoder;
+
+    if (dec != NULL) {
+        return dec;
+    }
+
+    dec = calloc(1, sizeof(struct Decoder));
+
+    pthread_mutex_init(&dec->lock, NULL);
+    pthread_cond_init(&dec->cond, NULL);
+    dec->running = true;
+
+    int workers = decodeWorkers();
+
+    // Wallpapers need no more than one worker per monitor.
+    if (settings.workers <= 0) {
+        workers = MIN(workers, settings.nmon);
+    }
+
+    decodeGrow(dec, workers);
+
+    if (dec->nthreads == 0) {
+        free(dec->threads);
+        free(dec);
+
+        return NULL;
+    }
+
+    settings.decoder = dec;
+
+    return dec;
+}
+
+int decodeWorkers()
+{
+    // Half the cores by default, Magick itself runs OpenMP threads too.
+    if (settings.workers > 0) {
+        return settings.workers;
+    }
+
+    return MAX(1, sysconf(_SC_NPROCESSORS_ONLN) / 2);
+}
+
+void decodeGrow(struct Decoder *dec, int workers)
+{
+    if (workers <= dec->nthreads) {
+        return;
+    }
+
+    dec->threads = realloc(dec->threads, workers * sizeof(pthread_t));
+
+    while (
+        dec->nthreads < workers &&
+        pthread_create(
+            &dec->threads[dec->nthreads],
+            NULL,
+            decodeWorker,
+            dec
+        ) == 0
+    ) {
+        dec->nthreads++;
+    }
+}
+
+void decodePush(int monitor, const char *path, bool back)
+{
+    struct Decoder *dec = decodeStart();
+    struct Plane *plane = &settings.planes[monitor];
+
+    if (dec == NULL) {
+        uint32_t texture = 0;
+
+        usePlane(plane);
+        loadTexture(
+            path,
+            back ? &plane->back : &texture,
+            plane->width,
+            plane->height
+        );
+
+        if (!back) {
+            cachePut(plane, texture, path);
+        }
+
+        return;
+    }
+
+    pthread_mutex_lock(&dec->lock);
+
+    dec->budget = settings.budget;
+
+    for (int i = 0; i < dec->njobs; i++) {
+        struct DecodeJob *job = &dec->jobs[i];
+
+        if (
+            job->monitor == monitor &&
+            job->back == back &&
+            !strcmp(job->path, path)
+        ) {
+            pthread_mutex_unlock(&dec->lock);
+            plane->pending |= back;
+
+            return;
+        }
+    }
+
+    dec->jobs = realloc(dec->jobs, (dec->njobs + 1) * sizeof(struct DecodeJob));
+
+    struct DecodeJob *job = &dec->jobs[dec->njobs++];
+
+    job->id = dec->serial++;
+    job->monitor = monitor;
+    job->back = back;
+    job->state = 0;
+    job->width = plane->width;
+    job->height = plane->height;
+    // The framebuffer object belongs to the first context only.
+    job->gpu = settings.gpu &&
+               settings.nheads == 1 &&
+               settings.opengl.format == COMPRESS_NONE &&
+               gpuInit();
+    job->refine = back && settings.draft != UndefinedFilter && !job->gpu;
+    job->drafted = false;
+    job->src_width = 0;
+    job->src_height = 0;
+    job->draft = NULL;
+    job->data = NULL;
+    job->client = NULL;
+    job->thumb = false;
+    job->written = false;
+    clock_gettime(CLOCK_MONOTONIC, &job->pushed);
+    sprintf(job->path, "%.*s", PATH_MAX - 1, path);
+
+    pthread_cond_signal(&dec->cond);
+    pthread_mutex_unlock(&dec->lock);
+
+    plane->pending |= back;
+}
+
+void thumbPush(struct Client *client, const char *name, int width,
+               int height)
+{
+    if (name[0] != '/') {
+        messageRespond("%s is not an absolute path\n", name);
+        return;
+    }
+
+    char file[PATH_MAX];
+    char *path = realpath(name, NULL);
+    struct Decoder *dec = NULL;
+
+    if (path == NULL || !diskPath(path, width, height, file)) {
+        messageRespond("%s failed\n", name);
+        free(path);
+        return;
+    }
+
+    bool cached = access(file, R_OK) == 0;
+
+    if (!cached && client != NULL) {
+        dec = decodeStart();
+    }
+
+    // Cached ones are answered right away, only misses reach the workers.
+    if (dec == NULL) {
+        struct Precache job = { path, width, height };
+
+        messageRespond(
+            "%s %s\n",
+            path,
+            cached || precacheImage(&job) >= 0 ? file : "failed"
+        );
+        free(path);
+        return;
+    }
+
+    pthread_mutex_lock(&dec->lock);
+
+    dec->jobs = realloc(dec->jobs, (dec->njobs + 1) * sizeof(struct DecodeJob));
+
+    struct DecodeJob *job = &dec->jobs[dec->njobs++];
+
+    memset(job, 0, sizeof(struct DecodeJob));
+    job->id = dec->serial++;
+    job->monitor = -1;
+    job->width = width;
+    job->height = height;
+    job->client = client;
+    job->thumb = true;
+    clock_gettime(CLOCK_MONOTONIC, &job->pushed);
+    sprintf(job->path, "%.*s", PATH_MAX - 1, path);
+
+    // The pool is sized for the monitors, thumbnail batches get more.
+    decodeGrow(dec, MIN(decodeWorkers(), dec->njobs));
+
+    pthread_cond_signal(&dec->cond);
+    pthread_mutex_unlock(&dec->lock);
+
+    client->thumbs++;
+    free(path);
+}
+
+void thumbDone(struct DecodeJob *job)
+{
+    char file[PATH_MAX];
+    struct Client *client = job->client;
+
+    // Hung up while we were decoding, the file is still kept.
+    if (client == NULL) {
+        return;
+    }
+
+    if (!job->written || !diskPath(job->path, job->width, job->height, file)) {
+        sprintf(file, "failed");
+    }
+
+    settings.client = client;
+    messageRespond("%s %s\n", job->path, file);
+    settings.client = NULL;
+
+    if (--client->thumbs == 0) {
+        client->done = true;
+    }
+}
+
+void decodeForget(struct Client *client)
+{
+    struct Decoder *dec = settings.decoder;
+
+    if (dec == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&dec->lock);
+
+    for (int i = 0; i < dec->njobs; i++) {
+        if (dec->jobs[i].client == client) {
+            dec->jobs[i].client = NULL;
+        }
+    }
+
+    pthread_mutex_unlock(&dec->lock);
+}
+
+void decodeRemap(const int *remap, int old_nmon)
+{
+    struct Decoder *dec = settings.decoder;
+
+    if (dec == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&dec->lock);
+
+    for (int i = 0; i < dec->njobs; i++) {
+        struct DecodeJob *job = &dec->jobs[i];
+
+        if (job->thumb) {
+            continue;
+        }
+
+        // remap holds the new index plus one, zero for removed outputs.
+        job->monitor = job->monitor >= 0 && job->monitor < old_nmon ?
+                       remap[job->monitor] - 1 : -1;
+
+        // Nobody will show it, a running decode is just dropped later.
+        if (job->monitor < 0 && job->state == 0) {
+            memmove(
+                &dec->jobs[i],
+                &dec->jobs[i + 1],
+                (--dec->njobs - i) * sizeof(struct DecodeJob)
+            );
+            i--;
+        }
+    }
+
+    pthread_mutex_unlock(&dec->lock);
+}
+
+struct Plane *jobPlane(const struct DecodeJob *job)
+{
+    if (job->monitor < 0 || job->monitor >= settings.nmon) {
+        return NULL;
+    }
+
+    return &settings.planes[job->monitor];
+}
+
+void decodeCollect()
+{
+    struct Decoder *dec = settings.decoder;
+
+    if (dec == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&dec->lock);
+
+    for (int i = 0; i < dec->njobs; i++) {
+        struct DecodeJob *draft = &dec->jobs[i];
+
+        // Show the draft once the real thing is late, keeps fades on time.
+        if (
+            draft->state != 1 ||
+            draft->draft == NULL ||
+            secondsSince(&draft->pushed) < settings.draft_time
+        ) {
+            continue;
+        }
+
+        struct Plane *plane = jobPlane(draft);
+
+        if (
+            plane != NULL &&
+            plane->width == draft->width &&
+            plane->height == draft->height &&
+            !strcmp(draft->path, plane->back_path)
+        ) {
+            usePlane(plane);
+            uploadTexture(&plane->back, draft->draft, draft->width,
+                          draft->height, draft->width);
+            draft->drafted = true;
+        }
+
+        free(draft->draft);
+        draft->draft = NULL;
+    }
+
+    for (int i = 0; i < dec->njobs; i++) {
+        struct DecodeJob job = dec->jobs[i];
+
+        if (job.state != 2) {
+            continue;
+        }
+
+        memmove(
+            &dec->jobs[i],
+            &dec->jobs[i + 1],
+            (--dec->njobs - i) * sizeof(struct DecodeJob)
+        );
+        i--;
+
+        if (job.thumb) {
+            thumbDone(&job);
+            continue;
+        }
+
+        struct Plane *plane = jobPlane(&job);
+
+        if (
+            plane != NULL &&
+            job.back &&
+            job.data == NULL &&
+            !strcmp(job.path, plane->back_path)
+        ) {
+            plane->failed = true;
+        }
+
+        // Monitors may have been resized or replaced meanwhile.
+        if (
+            plane == NULL ||
+            job.data == NULL ||
+            plane->width != job.width ||
+            plane->height != job.height
+        ) {
+            free(job.draft);
+            free(job.data);
+            continue;
+        }
+
+        free(job.draft);
+        usePlane(plane);
+
+        if (job.back && !strcmp(job.path, plane->back_path)) {
+            placeTexture(&plane->back, &job);
+        } else if (job.drafted && !strcmp(job.path, plane->front_path)) {
+            // The fade already ran on the draft, refine it in place.
+            placeTexture(&plane->front, &job);
+        } else if (job.drafted || !cacheHas(plane, job.path)) {
+            uint32_t texture = 0;
+
+            // A draft that already faded out may sit in the cache, the
+            // final pixels replace it there.
+            placeTexture(&texture, &job);
+            cachePut(plane, texture, job.path);
+        }
+
+        free(job.data);
+        trimMemory();
+    }
+
+    for (int i = 0; i < settings.nmon; i++) {
+        settings.planes[i].pending = false;
+    }
+
+    for (int i = 0; i < dec->njobs; i++) {
+        struct DecodeJob *job = &dec->jobs[i];
+
+        if (
+            job->back &&
+            !job->drafted &&
+            jobPlane(job) != NULL &&
+            !strcmp(job->path, jobPlane(job)->back_path)
+        ) {
+            settings.planes[job->monitor].pending = true;
+        }
+    }
+
+    pthread_mutex_unlock(&dec->lock);
+
+    // Pick something else rather than fade to a file that did not decode.
+    for (int i = 0; i < settings.nmon; i++) {
+        struct Plane *plane = &settings.planes[i];
+
+        if (plane->failed) {
+            plane->failed = false;
+            emitEvent("error %s\n", plane->back_path);
+            markFailed(i, plane->back_path);
+            randomImage(&plane->back, plane, plane->back_path, i);
+        }
+    }
+
+    struct Client *client = settings.clients;
+
+    // Thumbnail answers, flushed outside the lock as a flush may close.
+    while (client != NULL) {
+        struct Client *next = client->next;
+
+        if (client->out_len > 0) {
+            clientFlush(client);
+        }
+
+        client = next;
+    }
+}
+
+void decodeBudget()
+{
+    if (settings.decoder != NULL) {
+        pthread_mutex_lock(&settings.decoder->lock);
+        settings.decoder->spent = 0;
+        pthread_mutex_unlock(&settings.decoder->lock);
+    }
+}
+
+void decodeStop()
+{
+    struct Decoder *dec = settings.decoder;
+
+    if (dec == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&dec->lock);
+    dec->running = false;
+    pthread_cond_broadcast(&dec->cond);
+    pthread_mutex_unlock(&dec->lock);
+
+    for (int i = 0; i < dec->nthreads; i++) {
+        pthread_join(dec->threads[i], NULL);
+    }
+
+    for (int i = 0; i < dec->njobs; i++) {
+        free(dec->jobs[i].draft);
+        free(dec->jobs[i].data);
+    }
+
+    pthread_mutex_destroy(&dec->lock);
+    pthread_cond_destroy(&dec->cond);
+    free(dec->threads);
+    free(dec->jobs);
+    free(dec);
+
+    settings.decoder = NULL;
+}
+
+void *decodeWorker(void *arg)
+{
+    struct Decoder *dec = arg;
+
+    lowerPriority();
+
+    pthread_mutex_lock(&dec->lock);
+
+    while (dec->running) {
+        struct DecodeJob *job = NULL;
+
+        // Back images first, cache fills only while the budget lasts.
+        for (int i = 0; i < dec->njobs; i++) {
+            if (dec->jobs[i].state == 0 && (job == NULL || dec->jobs[i].back)) {
+                job = &dec->jobs[i];
+            }
+        }
+
+        if (job == NULL) {
+            pthread_cond_wait(&dec->cond, &dec->lock);
+            continue;
+        }
+
+        if (
+            !job->back &&
+            !job->thumb &&
+            dec->budget > 0 &&
+            dec->spent >= dec->budget
+        ) {
+            job->state = 2;
+            continue;
+        }
+
+        int id = job->id;
+        int width = job->width;
+        int height = job->height;
+        bool gpu = job->gpu;
+        bool refine = job->refine;
+        int src_width = 0;
+        int src_height = 0;
+        char path[PATH_MAX];
+
+        sprintf(path, "%s", job->path);
+        job->state = 1;
+
+        if (job->thumb) {
+            struct Precache thumb = { path, width, height };
+
+            pthread_mutex_unlock(&dec->lock);
+            bool written = precacheImage(&thumb) >= 0;
+            pthread_mutex_lock(&dec->lock);
+
+            for (int i = 0; i < dec->njobs; i++) {
+                if (dec->jobs[i].id == id) {
+                    dec->jobs[i].written = written;
+                    dec->jobs[i].state = 2;
+                }
+            }
+
+            continue;
+        }
+
+        pthread_mutex_unlock(&dec->lock);
+
+        struct timespec start;
+        struct timespec end;
+
+        // Per worker, process time would charge every job for the others.
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &start);
+        unsigned char *data = NULL;
+
+        if (gpu) {
+            data = loadSource(path, width, height, &src_width, &src_height);
+        }
+
+        MagickWand *wand = NULL;
+        unsigned char *draft = NULL;
+
+        if (data == NULL && refine) {
+            draft = draftPixels(path, width, height, &wand);
+        }
+
+        if (draft != NULL) {
+            pthread_mutex_lock(&dec->lock);
+
+            for (int i = 0; i < dec->njobs; i++) {
+                if (dec->jobs[i].id == id) {
+                    dec->jobs[i].draft = draft;
+                    draft = NULL;
+                }
+            }
+
+            pthread_mutex_unlock(&dec->lock);
+            free(draft);
+
+            uint64_t key = 0;
+
+            if (resizeImage(wand, width, height, settings.filter)) {
+                data = exportPixels(wand, width, height);
+            }
+
+            DestroyMagickWand(wand);
+
+            if (settings.shared != NULL && imageKey(path, width, height, &key)) {
+                sharedPut(key, width, height, data);
+            }
+        }
+
+        if (data == NULL) {
+            src_width = 0;
+            data = loadPixels(path, width, height);
+        }
+
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &end);
+
+        pthread_mutex_lock(&dec->lock);
+
+        dec->spent += (end.tv_sec - start.tv_sec) +
+                      (end.tv_nsec - start.tv_nsec) / 1e9;
+
+        for (int i = 0; i < dec->njobs; i++) {
+            if (dec->jobs[i].id == id) {
+                dec->jobs[i].src_width = src_width;
+                dec->jobs[i].src_height = src_height;
+                dec->jobs[i].data = data;
+                dec->jobs[i].state = 2;
+            }
+        }
+    }
+
+    pthread_mutex_unlock(&dec->lock);
+
+    return NULL;
+}
+
+void placeTexture(uint32_t *id, struct DecodeJob *job)
+{
+    if (job->src_width == 0) {
+        uploadTexture(id, job->data, job->width, job->height, job->width);
+    } else if (!gpuResize(
+                   id,
+                   job->data,
+                   job->src_width,
+                   job->src_height,
+                   job->width,
+                   job->height
+               )) {
+        // The framebuffer went away, redo this one on the CPU.
+        settings.opengl.fbo = false;
+        loadTexture(job->path, id, job->width, job->height);
+    }
+}
+
+void wandError(MagickWand *wand)
+{
+    char *description;
+    ExceptionType severity;
+
+    // Resource limits make these fail by design, the image is skipped.
+    description = MagickGetException(wand, &severity);
+    fprintf(stderr, "Wand Error: %s\n", description);
+    MagickRelinquishMemory(description);
+}
+
+bool readImage(MagickWand *wand, const char *current)
+{
+    // Only the first frame, animations are streamed by animationWorker.
+    char first[PATH_MAX + 4];
+    sprintf(first, "%.*s[0]", PATH_MAX - 1, current);
+
+    if (MagickReadImage(wand, first) != MagickFalse) {
+        return true;
+    }
+
+    // Unreadable files are skipped, they must not take the daemon down.
+    ExceptionType severity;
+    char *description = MagickGetException(wand, &severity);
+
+    fprintf(stderr, "Unable to read %s: %s\n", current, description);
+    MagickRelinquishMemory(description);
+
+    return false;
+}
+
+bool validImage(const char *path)
+{
+    MagickWand *wand = NewMagickWand();
+    bool valid = MagickPingImage(wand, path) != MagickFalse;
+
+    DestroyMagickWand(wand);
+
+    return valid;
+}
+
+MagickWand *doMagick(const char *current, int width, int height)
+{
+    MagickWand *wand = NewMagickWand();
+
+    if (!readImage(wand, current)) {
+        DestroyMagickWand(wand);
+        return NULL;
+    }
+
+    if (!fitImage(wand, width, height)) {
+        DestroyMagickWand(wand);
+        return NULL;
+    }
+
+    return wand;
+}
+
+bool fitImage(MagickWand *wand, int width, int height)
+{
+    return cropImage(wand, width, height) &&
+           resizeImage(wand, width, height, settings.filter);
+}
+
+bool cropImage(MagickWand *wand, int width, int height)
+{
+    int status = MagickSetImageGravity(wand, CenterGravity);
+
+    if (status == MagickFalse) {
+        wandError(wand);
+        return false;
+    }
+
+    int orig_height = MagickGetImageHeight(wand);
+    int orig_width = MagickGetImageWidth(wand);
+
+    int newheight = orig_height;
+    int newwidth = orig_width;
+    double screen_aspect = (double)width / (double)height;
+    double image_aspect = (double)orig_width / (double)orig_height;
+
+    if (screen_aspect < image_aspect) {
+        newwidth = (int)((double)orig_height * screen_aspect);
+    } else {
+        newheight = (int)((double)orig_width / screen_aspect);
+    }
+
+    if (settings.center) {
+        status = MagickCropImage(
+                     wand,
+                     newwidth,
+                     newheight,
+                     (orig_width - newwidth) / 2,
+                     (orig_height - newheight) / 2
+                 );
+    } else {
+        status = MagickCropImage(wand, newwidth, newheight, 0, 0);
+    }
+
+    if (status == MagickFalse) {
+        wandError(wand);
+        return false;
+    }
+
+    return true;
+}
+
+bool resizeImage(MagickWand *wand, int width, int height, int filter)
+{
+    #if ImageMagick_MajorVersion < 7 || GraphicsMagick
+    int status = MagickResizeImage(wand, width, height, filter, 1.0);
+    #else
+    int status = MagickResizeImage(wand, width, height, filter);
+    #endif
+
+    if (status == MagickFalse) {
+        wandError(wand);
+        return false;
+    }
+
+    return true;
+}
+
+unsigned char *draftPixels(const char *current, int width, int height,
+                           MagickWand **wand)
+{
+    char file[PATH_MAX];
+    uint64_t key = 0;
+
+    // Cached pixels are final already, there is nothing to refine.
+    if (diskPath(current, width, height, file) && access(file, R_OK) == 0) {
+        return NULL;
+    }
+
+    if (settings.shared != NULL && imageKey(current, width, height, &key)) {
+        unsigned char *data = sharedGet(key, width, height);
+
+        if (data != NULL) {
+            free(data);
+            return NULL;
+        }
+    }
+
+    // Huge sources take the bounded streaming path in loadPixels, a full
+    // read just for the draft would defeat its memory limit.
+    MagickWand *ping = NewMagickWand();
+    char first[PATH_MAX + 4];
+    bool huge = false;
+
+    sprintf(first, "%.*s[0]", PATH_MAX - 1, current);
+
+    if (settings.stream > 0 && MagickPingImage(ping, first) != MagickFalse) {
+        huge = (uint64_t)MagickGetImageWidth(ping) *
+               MagickGetImageHeight(ping) >= settings.stream;
+    }
+
+    DestroyMagickWand(ping);
+
+    if (huge) {
+        return NULL;
+    }
+
+    *wand = NewMagickWand();
+
+    if (!readImage(*wand, current)) {
+        DestroyMagickWand(*wand);
+        *wand = NULL;
+        return NULL;
+    }
+
+    if (!cropImage(*wand, width, height)) {
+        DestroyMagickWand(*wand);
+        *wand = NULL;
+        return NULL;
+    }
+
+    MagickWand *draft = CloneMagickWand(*wand);
+    unsigned char *data = NULL;
+
+    if (resizeImage(draft, width, height, settings.draft)) {
+        data = exportPixels(draft, width, height);
+    }
+
+    DestroyMagickWand(draft);
+
+    // No draft means no refine either, loadPixels starts over.
+    if (data == NULL) {
+        DestroyMagickWand(*wand);
+        *wand = NULL;
+    }
+
+    return data;
+}
+
+bool streamCrop(struct Stream *stream, int src_width, int src_height,
+                int width, int height)
+{
+    double screen_aspect = (double)width / (double)height;
+    double image_aspect = (double)src_width / (double)src_height;
+
+    stream->width = src_width;
+    stream->height = src_height;
+
+    if (screen_aspect < image_aspect) {
+        stream->width = (int)((double)src_height * screen_aspect);
+    } else {
+        stream->height = (int)((double)src_width / screen_aspect);
+    }
+
+    stream->x = settings.center ? (src_width - stream->width) / 2 : 0;
+    stream->y = settings.center ? (src_height - stream->height) / 2 : 0;
+    stream->out_width = width;
+    stream->out_height = height;
+
+    // Box filtering only shrinks, anything else goes through Magick.
+    return stream->width >= width && stream->height >= height;
+}
+
+void streamBegin(struct Stream *stream, size_t line)
+{
+    stream->columns = malloc((stream->out_width + 1) * sizeof(int));
+    stream->acc = calloc((size_t)stream->out_width * 3, sizeof(uint64_t));
+    stream->line = malloc(line);
+    stream->data = malloc((size_t)stream->out_width * stream->out_height * 3);
+
+    for (int x = 0; x <= stream->out_width; x++) {
+        stream->columns[x] = stream->x + (int)(
+                                 (int64_t)x * stream->width / stream->out_width
+                             );
+    }
+}
+
+void streamRow(struct Stream *stream, const unsigned char *row, int y)
+{
+    if (y < stream->y || streamDone(stream)) {
+        return;
+    }
+
+    for (int x = 0; x < stream->out_width; x++) {
+        uint64_t *acc = &stream->acc[x * 3];
+
+        for (int i = stream->columns[x]; i < stream->columns[x + 1]; i++) {
+            acc[0] += row[i * 3];
+            acc[1] += row[i * 3 + 1];
+            acc[2] += row[i * 3 + 2];
+        }
+    }
+
+    stream->band++;
+
+    int end = stream->y + (int)(
+                  (int64_t)(stream->row + 1) * stream->height / stream->out_height
+              );
+
+    if (y + 1 < end) {
+        return;
+    }
+
+    unsigned char *out = &stream->data[
+                             (size_t)stream->row * stream->out_width * 3
+                         ];
+
+    for (int x = 0; x < stream->out_width; x++) {
+        uint64_t n = (uint64_t)(stream->columns[x + 1] - stream->columns[x]) *
+                     stream->band;
+
+        for (int c = 0; c < 3; c++) {
+            out[x * 3 + c] = (stream->acc[x * 3 + c] + n / 2) / n;
+        }
+    }
+
+    memset(stream->acc, 0, (size_t)stream->out_width * 3 * sizeof(uint64_t));
+    stream->band = 0;
+    stream->row++;
+}
+
+bool streamDone(struct Stream *stream)
+{
+    return stream->data != NULL && stream->row == stream->out_height;
+}
+
+unsigned char *streamFinish(struct Stream *stream)
+{
+    unsigned char *data = NULL;
+
+    if (streamDone(stream)) {
+        data = stream->data;
+    } else {
+        free(stream->data);
+    }
+
+    free(stream->columns);
+    free(stream->acc);
+    free(stream->line);
+    free(stream);
+
+    return data;
+}
+
+#ifdef HAVE_JPEG
+struct JpegError {
+    struct jpeg_error_mgr mgr;
+    jmp_buf jump;
+};
+
+void jpegError(j_common_ptr info)
+{
+    longjmp(((struct JpegError *)info->err)->jump, 1);
+}
+
+unsigned char *streamJpeg(FILE *file, int width, int height, bool *refused)
+{
+    struct jpeg_decompress_struct info;
+    struct JpegError error;
+    struct Stream *stream = calloc(1, sizeof(struct Stream));
+
+    info.err = jpeg_std_error(&error.mgr);
+    error.mgr.error_exit = jpegError;
+
+    if (setjmp(error.jump)) {
+        jpeg_destroy_decompress(&info);
+        free(streamFinish(stream));
+
+        return NULL;
+    }
+
+    jpeg_create_decompress(&info);
+    jpeg_stdio_src(&info, file);
+    jpeg_read_header(&info, TRUE);
+
+    if (
+        info.jpeg_color_space == JCS_CMYK ||
+        info.jpeg_color_space == JCS_YCCK ||
+        (uint64_t)info.image_width * info.image_height < settings.stream ||
+        !streamCrop(stream, info.image_width, info.image_height, width, height)
+    ) {
+        jpeg_destroy_decompress(&info);
+        free(streamFinish(stream));
+
+        return NULL;
+    }
+
+    // Progressive files keep coefficients for the whole image no matter the
+    // scale, and a full decode is no better. Above the threshold they are
+    // refused, raising stream= lets them through.
+    if (jpeg_has_multiple_scans(&info)) {
+        jpeg_destroy_decompress(&info);
+        free(streamFinish(stream));
+        *refused = true;
+
+        return NULL;
+    }
+
+    // The IDCT does the coarse part of the downscale for free.
+    int denom = 8;
+
+    while (
+        denom > 1 && (
+            stream->width / denom < width ||
+            stream->height / denom < height
+        )
+    ) {
+        denom /= 2;
+    }
+
+    info.out_color_space = JCS_RGB;
+    info.scale_num = 1;
+    info.scale_denom = denom;
+
+    jpeg_start_decompress(&info);
+
+    if (
+        !streamCrop(
+            stream,
+            info.output_width,
+            info.output_height,
+            width,
+            height
+        )
+    ) {
+        jpeg_destroy_decompress(&info);
+        free(streamFinish(stream));
+
+        return NULL;
+    }
+
+    streamBegin(stream, (size_t)info.output_width * info.output_components);
+
+    while (
+        info.output_scanline < info.output_height &&
+        !streamDone(stream)
+    ) {
+        int y = info.output_scanline;
+
+        jpeg_read_scanlines(&info, &stream->line, 1);
+        streamRow(stream, stream->line, y);
+    }
+
+    jpeg_destroy_decompress(&info);
+
+    return streamFinish(stream);
+}
+#endif
+
+#ifdef HAVE_PNG
+unsigned char *streamPng(FILE *file, int width, int height)
+{
+    png_structp png = png_create_read_struct(
+                          PNG_LIBPNG_VER_STRING,
+                          NULL,
+                          NULL,
+                          NULL
+                      );
+    png_infop info = png ? png_create_info_struct(png) : NULL;
+    struct Stream *stream = calloc(1, sizeof(struct Stream));
+
+    if (info == NULL || setjmp(png_jmpbuf(png))) {
+        png_destroy_read_struct(&png, &info, NULL);
+        free(streamFinish(stream));
+
+        return NULL;
+    }
+
+    png_init_io(png, file);
+    png_read_info(png, info);
+
+    uint32_t src_width = png_get_image_width(png, info);
+    uint32_t src_height = png_get_image_height(png, info);
+
+    // Interlaced passes need the whole image, leave those to Magick.
+    if (
+        png_get_interlace_type(png, info) != PNG_INTERLACE_NONE ||
+        (uint64_t)src_width * src_height < settings.stream ||
+        !streamCrop(stream, src_width, src_height, width, height)
+    ) {
+        png_destroy_read_struct(&png, &info, NULL);
+        free(streamFinish(stream));
+
+        return NULL;
+    }
+
+    png_set_expand(png);
+    png_set_strip_16(png);
+    png_set_strip_alpha(png);
+    png_set_gray_to_rgb(png);
+    png_read_update_info(png, info);
+
+    streamBegin(stream, png_get_rowbytes(png, info));
+
+    for (uint32_t y = 0; y < src_height && !streamDone(stream); y++) {
+        png_read_row(png, stream->line, NULL);
+        streamRow(stream, stream->line, y);
+    }
+
+    png_destroy_read_struct(&png, &info, NULL);
+
+    return streamFinish(stream);
+}
+#endif
+
+unsigned char *streamPixels(const char *path, int width, int height,
+                            bool *refused)
+{
+    unsigned char magic[8] = { 0 };
+    unsigned char *data = NULL;
+
+    *refused = false;
+
+    if (settings.stream == 0) {
+        return NULL;
+    }
+
+    FILE *file = fopen(path, "rb");
+
+    if (file == NULL) {
+        return NULL;
+    }
+
+    if (fread(magic, 1, sizeof(magic), file) != sizeof(magic)) {
+        fclose(file);
+
+        return NULL;
+    }
+
+    rewind(file);
+
+    #ifdef HAVE_JPEG
+    if (magic[0] == 0xFF && magic[1] == 0xD8 && magic[2] == 0xFF) {
+        data = streamJpeg(file, width, height, refused);
+    }
+    #endif
+
+    #ifdef HAVE_PNG
+    if (png_sig_cmp(magic, 0, sizeof(magic)) == 0) {
+        data = streamPng(file, width, height);
+    }
+    #endif
+
+    fclose(file);
+
+    if (*refused) {
+        fprintf(stderr, "Skipping %s, progressive and over stream\n", path);
+    }
+
+    return data;
+}
+
+bool getCacheDir(char *dir, bool create)
+{
+    const char *base = getenv("XDG_CACHE_HOME");
+
+    if (base != NULL && base[0] != '\0') {
+        snprintf(dir, PATH_MAX, "%s", base);
+    } else {
+        snprintf(dir, PATH_MAX, "%s/.cache", getHomeDir());
+    }
+
+    if (create) {
+        mkdir(dir, 0700);
+    }
+
+    size_t len = strlen(dir);
+    snprintf(dir + len, PATH_MAX - len, "/wallfade");
+
+    if (create && mkdir(dir, 0700) != 0 && errno != EEXIST) {
+        fprintf(stderr, "Unable to create %s: %s\n", dir, strerror(errno));
+        return false;
+    }
+
+    return true;
+}
+
+bool imageKey(const char *path, int width, int height, uint64_t *key)
+{
+    struct stat st;
+
+    if (stat(path, &st) != 0) {
+        return false;
+    }
+
+    // FNV-1a over everything that changes the resized pixels.
+    uint64_t hash = 14695981039346656037ULL;
+    int64_t fields[] = {
+        st.st_mtim.tv_sec,
+        st.st_mtim.tv_nsec,
+        st.st_size,
+        width,
+        height,
+        settings.center
+    };
+
+    for (const char *c = path; *c != '\0'; c++) {
+        hash = (hash ^ (unsigned char)*c) * 1099511628211ULL;
+    }
+
+    for (size_t i = 0; i < sizeof(fields); i++) {
+        hash = (hash ^ ((unsigned char *)fields)[i]) * 1099511628211ULL;
+    }
+
+    // Zero marks a free slot in the shared index.
+    *key = hash ? hash : 1;
+
+    return true;
+}
+
+bool diskPath(const char *path, int width, int height, char *file)
+{
+    char dir[PATH_MAX];
+    uint64_t hash;
+
+    if (!imageKey(path, width, height, &hash) || !getCacheDir(dir, false)) {
+        return false;
+    }
+
+    snprintf(
+        file,
+        PATH_MAX,
+        "%.*s/%016llx.rgb",
+        PATH_MAX - 32,
+        dir,
+        (unsigned long long)hash
+    );
+
+    return true;
+}
+
+unsigned char *diskRead(const char *path, int width, int height)
+{
+    char file[PATH_MAX];
+
+    if (!diskPath(path, width, height, file)) {
+        return NULL;
+    }
+
+    FILE *fp = fopen(file, "rb");
+
+    if (fp == NULL) {
+        return NULL;
+    }
+
+    char magic[4];
+    int32_t size[2];
+    size_t bytes = (size_t)width * height * 3;
+    unsigned char *data = malloc(bytes);
+
+    if (
+        fread(magic, sizeof(magic), 1, fp) != 1 ||
+        memcmp(magic, DISK_MAGIC, sizeof(magic)) != 0 ||
+        fread(size, sizeof(size), 1, fp) != 1 ||
+        size[0] != width ||
+        size[1] != height ||
+        fread(data, bytes, 1, fp) != 1
+    ) {
+        free(data);
+        data = NULL;
+    }
+
+    fclose(fp);
+
+    return data;
+}
+
+bool diskWrite(const char *path, int width, int height,
+               const unsigned char *data)
+{
+    char file[PATH_MAX];
+
+    if (!diskPath(path, width, height, file)) {
+        return false;
+    }
+
+    return writePixels(file, width, height, data, NULL);
+}
+
+bool writePixels(const char *file, int width, int height,
+                 const unsigned char *data, const char *trailer)
+{
+    char tmp[PATH_MAX + 32];
+    static int serial = 0;
+    int id;
+
+    #pragma omp atomic capture
+    id = serial++;
+
+    snprintf(tmp, sizeof(tmp), "%s.%d.%d.tmp", file, (int)getpid(), id);
+
+    FILE *fp = fopen(tmp, "wb");
+
+    if (fp == NULL) {
+        return false;
+    }
+
+    int32_t size[2] = { width, height };
+    bool ok = (
+                  fwrite(DISK_MAGIC, 4, 1, fp) == 1 &&
+                  fwrite(size, sizeof(size), 1, fp) == 1 &&
+                  fwrite(data, (size_t)width * height * 3, 1, fp) == 1
+              );
+
+    if (trailer != NULL) {
+        ok = ok && fwrite(trailer, strlen(trailer), 1, fp) == 1;
+    }
+
+    ok = (fclose(fp) == 0) && ok;
+
+    // Readers only ever see complete files, an interrupted run leaves a
+    // stray .tmp at worst.
+    if (!ok || rename(tmp, file) != 0) {
+        unlink(tmp);
+        return false;
+    }
+
+    return true;
+}
+
+void snapshotPath(int monitor, char *file)
+{
+    char dir[PATH_MAX];
+    char display[64];
+
+    getCacheDir(dir, false);
+    displayName(display, sizeof(display));
+
+    // Several displays share one cache, as do the screens of one display.
+    snprintf(
+        file,
+        PATH_MAX,
+        "%.*s/snapshot-%s-%d-%d.rgb",
+        PATH_MAX - 128,
+        dir,
+        display,
+        settings.heads[settings.planes[monitor].head].screen,
+        monitor
+    );
+}
+
+void *snapshotWorker(void *arg)
+{
+    struct Snapshot *snap = arg;
+
+    lowerPriority();
+
+    while (snap != NULL) {
+        struct Snapshot *next = snap->next;
+
+        if (!writePixels(snap->file, snap->width, snap->height, snap->data,
+                         snap->path)) {
+            fprintf(stderr, "Unable to write %s\n", snap->file);
+        }
+
+        free(snap->data);
+        free(snap);
+
+        snap = next;
+    }
+
+    return NULL;
+}
+
+void snapshotWait()
+{
+    if (settings.snapshotting) {
+        pthread_join(settings.snapshot, NULL);
+        settings.snapshotting = false;
+    }
+}
+
+void saveSnapshot(int monitor)
+{
+    struct Plane *plane = &settings.planes[monitor];
+    char dir[PATH_MAX];
+
+    // Nothing new since the last write, the file on disk is still right.
+    if (
+        plane->front == 0 ||
+        !strcmp(plane->saved_path, plane->front_path) ||
+        !getCacheDir(dir, true)
+    ) {
+        return;
+    }
+
+    struct Snapshot *snap = malloc(sizeof(struct Snapshot));
+
+    snap->width = plane->width;
+    snap->height = plane->height;
+    snap->data = malloc((size_t)plane->width * plane->height * 3);
+    sprintf(snap->path, "%.*s", PATH_MAX - 1, plane->front_path);
+    snapshotPath(monitor, snap->file);
+
+    // Reading back has to happen here, the write does not.
+    usePlane(plane);
+
+    glBindTexture(GL_TEXTURE_2D, plane->front);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glGetTexImage(GL_TEXTURE_2D, 0, GL_RGB, GL_UNSIGNED_BYTE, snap->data);
+
+    sprintf(plane->saved_path, "%.*s", PATH_MAX - 1, plane->front_path);
+
+    snap->next = settings.snapshots;
+    settings.snapshots = snap;
+}
+
+void snapshotFlush()
+{
+    struct Snapshot *batch = settings.snapshots;
+
+    if (batch == NULL) {
+        return;
+    }
+
+    settings.snapshots = NULL;
+
+    // One writer per transition, fades are seconds apart so the previous
+    // batch is long done by now.
+    snapshotWait();
+
+    if (pthread_create(&settings.snapshot, NULL, snapshotWorker, batch) == 0) {
+        settings.snapshotting = true;
+    } else {
+        snapshotWorker(batch);
+    }
+}
+
+bool loadSnapshot(int monitor)
+{
+    struct Plane *plane = &settings.planes[monitor];
+    char file[PATH_MAX];
+    struct stat st;
+
+    snapshotPath(monitor, file);
+
+    int fd = open(file, O_RDONLY | O_CLOEXEC);
+
+    if (fd < 0) {
+        return false;
+    }
+
+    size_t header = 4 + 2 * sizeof(int32_t);
+    size_t bytes = (size_t)plane->width * plane->height * 3;
+
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < header + bytes) {
+        close(fd);
+        return false;
+    }
+
+    unsigned char *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (map == MAP_FAILED) {
+        return false;
+    }
+
+    int32_t size[2];
+    memcpy(size, map + 4, sizeof(size));
+
+    bool ok = (
+                  memcmp(map, DISK_MAGIC, 4) == 0 &&
+                  size[0] == plane->width &&
+                  size[1] == plane->height
+              );
+
+    if (ok) {
+        size_t len = st.st_size - header - bytes;
+
+        usePlane(plane);
+        uploadTexture(&plane->front, map + header, plane->width,
+                      plane->height, plane->width);
+
+        sprintf(
+            plane->front_path,
+            "%.*s",
+            (int)(len < PATH_MAX ? len : PATH_MAX - 1),
+            map + header + bytes
+        );
+        sprintf(plane->saved_path, "%.*s", PATH_MAX - 1, plane->front_path);
+    }
+
+    munmap(map, st.st_size);
+
+    return ok;
+}
+
+int loadSnapshots()
+{
+    int loaded = 0;
+
+    for (int i = 0; i < settings.nmon; i++) {
+        loaded += loadSnapshot(i);
+    }
+
+    if (loaded == 0) {
+        return 0;
+    }
+
+    for (int h = 0; h < settings.nheads; h++) {
+        useHead(h);
+
+        glClear(GL_COLOR_BUFFER_BIT);
+        buildQuads();
+
+        for (int i = 0; i < settings.nmon; i++) {
+            if (settings.planes[i].head == h && settings.planes[i].front != 0) {
+                drawPlane(i, settings.planes[i].front, 1.0f);
+            }
+        }
+
+        glXSwapBuffers(settings.dpy, settings.win);
+    }
+
+    // A span is only warm when every slice came back from the same image.
+    settings.warm = !settings.span || loaded == settings.nmon;
+
+    for (int i = 1; settings.span && i < settings.nmon; i++) {
+        settings.warm &= !strcmp(
+                             settings.planes[i].front_path,
+                             settings.planes[0].front_path
+                         );
+    }
+
+    printf("Restored %d of %d monitors from snapshot\n", loaded, settings.nmon);
+
+    return loaded;
+}
+
+void getSharedName(char *name, size_t size)
+{
+    snprintf(name, size, "/wallfade-%d", (int)getuid());
+}
+
+int sharedLock()
+{
+    char name[64];
+
+    getSharedName(name, sizeof(name) - 8);
+    strcat(name, ".lock");
+
+    // Peers hold LOCK_SH on the region itself, setup and teardown are
+    // serialized on this one instead.
+    while (true) {
+        struct stat held;
+        struct stat named;
+        int fd = shm_open(name, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+
+        if (fd < 0 || flock(fd, LOCK_EX) != 0) {
+            if (fd >= 0) {
+                close(fd);
+            }
+
+            return -1;
+        }
+
+        // The last user unlinks it, only a lock still under the name counts.
+        int check = shm_open(name, O_RDWR | O_CLOEXEC, 0600);
+        bool live = (
+                        check >= 0 &&
+                        fstat(fd, &held) == 0 &&
+                        fstat(check, &named) == 0 &&
+                        held.st_ino == named.st_ino
+                    );
+
+        if (check >= 0) {
+            close(check);
+        }
+
+        if (live) {
+            return fd;
+        }
+
+        close(fd);
+    }
+}
+
+bool sharedAttach()
+{
+    char name[64];
+    struct stat st;
+
+    if (settings.shared_size == 0) {
+        return false;
+    }
+
+    getSharedName(name, sizeof(name));
+
+    int lock = sharedLock();
+
+    if (lock < 0) {
+        fprintf(stderr, "Unable to lock %s: %s\n", name, strerror(errno));
+        return false;
+    }
+
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+
+    if (fd < 0) {
+        fprintf(stderr, "Unable to open %s: %s\n", name, strerror(errno));
+        close(lock);
+        return false;
+    }
+
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        close(lock);
+        return false;
+    }
+
+    size_t size = st.st_size;
+
+    if (size == 0) {
+        size = settings.shared_size;
+
+        if (ftruncate(fd, size) != 0) {
+            close(fd);
+            shm_unlink(name);
+            close(lock);
+            return false;
+        }
+    }
+
+    struct SharedHeader *shared = mmap(
+                                      NULL,
+                                      size,
+                                      PROT_READ | PROT_WRITE,
+                                      MAP_SHARED,
+                                      fd,
+                                      0
+                                  );
+
+    if (shared == MAP_FAILED) {
+        close(fd);
+        close(lock);
+        return false;
+    }
+
+    if (shared->magic != SHARED_MAGIC) {
+        memset(shared, 0, sizeof(struct SharedHeader));
+        shared->size = size;
+        atomic_store(&shared->top, (sizeof(struct SharedHeader) + 63) & ~63);
+        shared->magic = SHARED_MAGIC;
+    }
+
+    // Every user holds a shared lock until it detaches.
+    flock(fd, LOCK_SH);
+    close(lock);
+
+    settings.shared = shared;
+    settings.shared_fd = fd;
+
+    printf("Shared cache: %s, %zu MiB\n", name, size >> 20);
+
+    return true;
+}
+
+void sharedDetach()
+{
+    char name[64];
+
+    if (settings.shared == NULL) {
+        return;
+    }
+
+    getSharedName(name, sizeof(name));
+
+    int lock = sharedLock();
+
+    // Only the last user gets the exclusive lock.
+    if (flock(settings.shared_fd, LOCK_EX | LOCK_NB) == 0) {
+        shm_unlink(name);
+
+        if (lock >= 0) {
+            strcat(name, ".lock");
+            shm_unlink(name);
+        }
+    }
+
+    munmap(settings.shared, settings.shared->size);
+    close(settings.shared_fd);
+
+    if (lock >= 0) {
+        close(lock);
+    }
+
+    settings.shared = NULL;
+    settings.shared_fd = -1;
+}
+
+unsigned char *sharedGet(uint64_t key, int width, int height)
+{
+    struct SharedHeader *shared = settings.shared;
+
+    if (shared == NULL) {
+        return NULL;
+    }
+
+    for (int i = 0; i < SHARED_PROBE; i++) {
+        struct SharedSlot *slot = &shared->slots[(key + i) % SHARED_SLOTS];
+        uint64_t found = atomic_load(&slot->key);
+
+        if (found == 0) {
+            return NULL;
+        }
+
+        if (
+            found != key ||
+            atomic_load_explicit(&slot->ready, memory_order_acquire) != 1 ||
+            slot->width != (uint32_t)width ||
+            slot->height != (uint32_t)height
+        ) {
+            continue;
+        }
+
+        size_t bytes = (size_t)width * height * 3;
+        unsigned char *data = malloc(bytes);
+
+        memcpy(data, (unsigned char *)shared + slot->offset, bytes);
+
+        return data;
+    }
+
+    return NULL;
+}
+
+void sharedPut(uint64_t key, int width, int height, const unsigned char *data)
+{
+    struct SharedHeader *shared = settings.shared;
+
+    if (shared == NULL || key == 0 || data == NULL) {
+        return;
+    }
+
+    for (int i = 0; i < SHARED_PROBE; i++) {
+        struct SharedSlot *slot = &shared->slots[(key + i) % SHARED_SLOTS];
+        uint64_t expected = 0;
+
+        if (atomic_load(&slot->key) == key) {
+            return;
+        }
+
+        // Space is never reused, the region goes away with its last user.
+        // Once it is full, claiming slots would only leave dead ones.
+        size_t bytes = (size_t)width * height * 3;
+
+        if (atomic_load(&shared->top) + bytes > shared->size) {
+            return;
+        }
+
+        if (!atomic_compare_exchange_strong(&slot->key, &expected, key)) {
+            continue;
+        }
+
+        uint64_t offset = atomic_fetch_add(&shared->top, (bytes + 63) & ~63);
+
+        if (offset + bytes > shared->size) {
+            atomic_store(&slot->ready, 2);
+            return;
+        }
+
+        slot->width = width;
+        slot->height = height;
+        slot->offset = offset;
+
+        memcpy((unsigned char *)shared + offset, data, bytes);
+        atomic_store_explicit(&slot->ready, 1, memory_order_release);
+
+        return;
+    }
+}
+
+unsigned char *loadPixels(const char *current, int width, int height)
+{
+    unsigned char *data = diskRead(current, width, height);
+    uint64_t key = 0;
+
+    if (data != NULL) {
+        return data;
+    }
+
+    if (settings.shared != NULL && imageKey(current, width, height, &key)) {
+        data = sharedGet(key, width, height);
+
+        if (data != NULL) {
+            return data;
+        }
+    }
+
+    // Huge sources are shrunk row by row instead of decoded whole.
+    bool refused = false;
+
+    data = streamPixels(current, width, height, &refused);
+
+    if (data != NULL || refused) {
+        sharedPut(key, width, height, data);
+        return data;
+    }
+
+    MagickWand *wand = doMagick(current, width, height);
+
+    if (wand == NULL) {
+        return NULL;
+    }
+
+    data = exportPixels(wand, width, height);
+
+    DestroyMagickWand(wand);
+    sharedPut(key, width, height, data);
+
+    return data;
+}
+
+unsigned char *loadSource(const char *current, int width, int height,
+                          int *src_width, int *src_height)
+{
+    char file[PATH_MAX];
+    char first[PATH_MAX + 4];
+    uint64_t key = 0;
+
+    // Pixels resized ahead of time beat any upload, loadPixels serves them.
+    if (diskPath(current, width, height, file) && access(file, R_OK) == 0) {
+        return NULL;
+    }
+
+    if (settings.shared != NULL && imageKey(current, width, height, &key)) {
+        unsigned char *data = sharedGet(key, width, height);
+
+        if (data != NULL) {
+            free(data);
+            return NULL;
+        }
+    }
+
+    // Sizes first, a source the GPU cannot take or one that has to be
+    // streamed must not be decoded whole just to be thrown away.
+    MagickWand *ping = NewMagickWand();
+    uint64_t full_width = 0;
+    uint64_t full_height = 0;
+    int scale = 1;
+
+    sprintf(first, "%.*s[0]", PATH_MAX - 1, current);
+
+    if (MagickPingImage(ping, first) != MagickFalse) {
+        full_width = MagickGetImageWidth(ping);
+        full_height = MagickGetImageHeight(ping);
+
+        char *format = MagickGetImageFormat(ping);
+
+        // Only libjpeg scales while decoding, by up to 1/8.
+        while (
+            format != NULL &&
+            !strcasecmp(format, "JPEG") &&
+            scale < 8 &&
+            full_width / (scale * 2) >= (uint64_t)width &&
+            full_height / (scale * 2) >= (uint64_t)height
+        ) {
+            scale *= 2;
+        }
+
+        MagickRelinquishMemory(format);
+    }
+
+    DestroyMagickWand(ping);
+
+    uint64_t max = settings.opengl.max_texture;
+
+    if (
+        full_width == 0 ||
+        (settings.stream > 0 && full_width * full_height >= settings.stream) ||
+        (full_width + scale - 1) / scale > max ||
+        (full_height + scale - 1) / scale > max
+    ) {
+        return NULL;
+    }
+
+    MagickWand *wand = NewMagickWand();
+
+    // Lets libjpeg scale by 1/2..1/8 while decoding, never below the target.
+    #ifdef GraphicsMagick
+    MagickSetSize(wand, width, height);
+    #else
+    char size[64];
+    sprintf(size, "%dx%d", width, height);
+    MagickSetOption(wand, "jpeg:size", size);
+    #endif
+
+    if (!readImage(wand, current)) {
+        DestroyMagickWand(wand);
+        return NULL;
+    }
+
+    *src_width = MagickGetImageWidth(wand);
+    *src_height = MagickGetImageHeight(wand);
+
+    if (
+        *src_width > settings.opengl.max_texture ||
+        *src_height > settings.opengl.max_texture
+    ) {
+        DestroyMagickWand(wand);
+        return NULL;
+    }
+
+    unsigned char *data = exportPixels(wand, *src_width, *src_height);
+
+    DestroyMagickWand(wand);
+
+    // Not published to the disk or shared cache: the resized pixels only
+    // exist in a texture, and reading them back would cost the render
+    // thread a glGetTexImage per decode, which is what the GPU path avoids.
+    return data;
+}
+
+bool gpuInit()
+{
+    struct OpenGL *gl = &settings.opengl;
+
+    if (gl->probed) {
+        return gl->fbo;
+    }
+
+    gl->probed = true;
+
+    int major = 0;
+    const char *version = (const char *)glGetString(GL_VERSION);
+    const char *extensions = (const char *)glGetString(GL_EXTENSIONS);
+
+    if (version != NULL) {
+        major = atoi(version);
+    }
+
+    if (
+        major < 3 &&
+        (extensions == NULL || !strstr(extensions, "GL_ARB_framebuffer_object"))
+    ) {
+        fprintf(stderr, "No framebuffer objects, resizing on the CPU\n");
+        return false;
+    }
+
+    gl->genFramebuffers = (PFNGLGENFRAMEBUFFERSPROC)glXGetProcAddress(
+                              (const GLubyte *)"glGenFramebuffers"
+                          );
+    gl->bindFramebuffer = (PFNGLBINDFRAMEBUFFERPROC)glXGetProcAddress(
+                              (const GLubyte *)"glBindFramebuffer"
+                          );
+    gl->framebufferTexture2D = (PFNGLFRAMEBUFFERTEXTURE2DPROC)glXGetProcAddress(
+                                   (const GLubyte *)"glFramebufferTexture2D"
+                               );
+    gl->checkFramebufferStatus =
+        (PFNGLCHECKFRAMEBUFFERSTATUSPROC)glXGetProcAddress(
+            (const GLubyte *)"glCheckFramebufferStatus"
+        );
+    gl->deleteFramebuffers = (PFNGLDELETEFRAMEBUFFERSPROC)glXGetProcAddress(
+                                 (const GLubyte *)"glDeleteFramebuffers"
+                             );
+    gl->generateMipmap = (PFNGLGENERATEMIPMAPPROC)glXGetProcAddress(
+                             (const GLubyte *)"glGenerateMipmap"
+                         );
+
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &gl->max_texture);
+
+    gl->fbo = (
+                  gl->genFramebuffers != NULL &&
+                  gl->bindFramebuffer != NULL &&
+                  gl->framebufferTexture2D != NULL &&
+                  gl->checkFramebufferStatus != NULL &&
+                  gl->deleteFramebuffers != NULL &&
+                  gl->generateMipmap != NULL &&
+                  gl->max_texture > 0
+              );
+
+    return gl->fbo;
+}
+
+bool gpuResize(uint32_t *id, const unsigned char *data, int src_width,
+               int src_height, int width, int height)
+{
+    struct OpenGL *gl = &settings.opengl;
+    struct Stream crop;
+
+    if (!gpuInit()) {
+        return false;
+    }
+
+    streamCrop(&crop, src_width, src_height, width, height);
+
+    uint32_t source = 0;
+    uint32_t fbo = 0;
+
+    glGenTextures(1, &source);
+    glBindTexture(GL_TEXTURE_2D, source);
+
+    glTexImage2D(
+        GL_TEXTURE_2D,
+        0,
+        GL_RGB,
+        src_width,
+        src_height,
+        0,
+        GL_RGB,
+        GL_UNSIGNED_BYTE,
+        data
+    );
+
+    // Trilinear sampling of the mip chain stands in for the Gaussian resize.
+    gl->generateMipmap(GL_TEXTURE_2D);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(
+        GL_TEXTURE_2D,
+        GL_TEXTURE_MIN_FILTER,
+        GL_LINEAR_MIPMAP_LINEAR
+    );
+
+    if (*id == 0) {
+        glGenTextures(1, id);
+        settings.textures++;
+        glBindTexture(GL_TEXTURE_2D, *id);
+
+        glTexImage2D(
+            GL_TEXTURE_2D,
+            0,
+            GL_RGB,
+            width,
+            height,
+            0,
+            GL_RGB,
+            GL_UNSIGNED_BYTE,
+            NULL
+        );
+
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    }
+
+    gl->genFramebuffers(1, &fbo);
+    gl->bindFramebuffer(GL_FRAMEBUFFER, fbo);
+    gl->framebufferTexture2D(
+        GL_FRAMEBUFFER,
+        GL_COLOR_ATTACHMENT0,
+        GL_TEXTURE_2D,
+        *id,
+        0
+    );
+
+    bool complete = gl->checkFramebufferStatus(GL_FRAMEBUFFER) ==
+                    GL_FRAMEBUFFER_COMPLETE;
+
+    if (complete) {
+        float u0 = (float)crop.x / src_width;
+        float v0 = (float)crop.y / src_height;
+        float u1 = (float)(crop.x + crop.width) / src_width;
+        float v1 = (float)(crop.y + crop.height) / src_height;
+
+        glPushAttrib(GL_VIEWPORT_BIT | GL_ENABLE_BIT);
+        glDisable(GL_BLEND);
+        glViewport(0, 0, width, height);
+
+        glMatrixMode(GL_PROJECTION);
+        glPushMatrix();
+        glLoadIdentity();
+        glOrtho(0, 1, 0, 1, -1, 1);
+        glMatrixMode(GL_MODELVIEW);
+        glPushMatrix();
+        glLoadIdentity();
+
+        // Framebuffer row 0 is texel row 0, the top of the image.
+        glBindTexture(GL_TEXTURE_2D, source);
+        glColor4f(1.0f, 1.0f, 1.0f, 1.0f);
+        glBegin(GL_QUADS);
+        glTexCoord2f(u0, v0);
+        glVertex2i(0, 0);
+        glTexCoord2f(u1, v0);
+        glVertex2i(1, 0);
+        glTexCoord2f(u1, v1);
+        glVertex2i(1, 1);
+        glTexCoord2f(u0, v1);
+        glVertex2i(0, 1);
+        glEnd();
+
+        glPopMatrix();
+        glMatrixMode(GL_PROJECTION);
+        glPopMatrix();
+        glMatrixMode(GL_MODELVIEW);
+        glPopAttrib();
+    }
+
+    gl->bindFramebuffer(GL_FRAMEBUFFER, 0);
+    gl->deleteFramebuffers(1, &fbo);
+    glDeleteTextures(1, &source);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    return complete;
+}
+
+unsigned char *exportPixels(MagickWand *wand, int width, int height)
+{
+    unsigned char *data = malloc((width * height) * 3);
+    #ifdef GraphicsMagick
+    int status = MagickGetImagePixels(
+                     wand,
+                     0,
+                     0,
+                     width,
+                     height,
+                     "RGB",
+                     CharPixel,
+                     data
+                 );
+    #else
+    int status = MagickExportImagePixels(
+                     wand,
+                     0,
+                     0,
+                     width,
+                     height,
+                     "RGB",
+                     CharPixel,
+                     data
+                 );
+    #endif
+
+    if (status == MagickFalse) {
+        wandError(wand);
+        free(data);
+        return NULL;
+    }
+
+    return data;
+}
+
+void uploadTexture(uint32_t *id, const unsigned char *data, int width,
+                   int height, int stride)
+{
+    int format = settings.opengl.format;
+
+    if (format == COMPRESS_NONE) {
+        uploadRaw(id, data, width, height, stride);
+        return;
+    }
+
+    if (*id == 0) {
+        glGenTextures(1, id);
+        settings.textures++;
+    }
+
+    glBindTexture(GL_TEXTURE_2D, *id);
+
+    // Compressed images are always respecified, there is no partial update.
+    if (format == COMPRESS_BC1) {
+        size_t size = (size_t)((width + 3) / 4) * ((height + 3) / 4) * 8;
+        unsigned char *blocks = malloc(size);
+
+        encodeBC1(data, width, height, stride, blocks);
+
+        glCompressedTexImage2D(
+            GL_TEXTURE_2D,
+            0,
+            GL_COMPRESSED_RGB_S3TC_DXT1_EXT,
+            width,
+            height,
+            0,
+            size,
+            blocks
+        );
+
+        free(blocks);
+    } else {
+        uint16_t *packed = malloc((size_t)width * height * sizeof(uint16_t));
+
+        #pragma omp parallel for schedule(static)
+        for (int y = 0; y < height; y++) {
+            for (int x = 0; x < width; x++) {
+                packed[(size_t)y * width + x] = packRGB565(
+                                                    data + ((size_t)y * stride + x) * 3
+                                                );
+            }
+        }
+
+        glTexImage2D(
+            GL_TEXTURE_2D,
+            0,
+            GL_RGB5,
+            width,
+            height,
+            0,
+            GL_RGB,
+            GL_UNSIGNED_SHORT_5_6_5,
+            packed
+        );
+
+        free(packed);
+    }
+
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+void uploadRaw(uint32_t *id, const unsigned char *data, int width,
+               int height, int stride)
+{
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, stride);
+
+    if (*id != 0) {
+        glBindTexture(GL_TEXTURE_2D, *id);
+
+        glTexSubImage2D(
+            GL_TEXTURE_2D,
+            0,
+            0,
+            0,
+            width,
+            height,
+            GL_RGB,
+            GL_UNSIGNED_BYTE,
+            data
+        );
+    } else {
+        glGenTextures(1, id);
+        settings.textures++;
+        glBindTexture(GL_TEXTURE_2D, *id);
+
+        glTexImage2D(
+            GL_TEXTURE_2D,
+            0,
+            GL_RGB,
+            width,
+            height,
+            0,
+            GL_RGB,
+            GL_UNSIGNED_BYTE,
+            data
+        );
+    }
+
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+const char *compressName(int compress)
+{
+    switch (compress) {
+        case COMPRESS_RGB565:
+            return "rgb565";
+
+        case COMPRESS_BC1:
+            return "bc1";
+
+        default:
+            return "none";
+    }
+}
+
+int parseCompress(const char *name)
+{
+    for (int compress = COMPRESS_NONE; compress <= COMPRESS_BC1; compress++) {
+        if (!strcasecmp(name, compressName(compress))) {
+            return compress;
+        }
+    }
+
+    fprintf(stderr, "Unknown compression %s, using none\n", name);
+
+    return COMPRESS_NONE;
+}
+
+void encodeBC1(const unsigned char *data, int width, int height, int stride,
+               unsigned char *out)
+{
+    int blocks_x = (width + 3) / 4;
+    int blocks_y = (height + 3) / 4;
+
+    #pragma omp parallel for schedule(static)
+    for (int by = 0; by < blocks_y; by++) {
+        for (int bx = 0; bx < blocks_x; bx++) {
+            unsigned char block[16][3];
+
+            // Edge blocks repeat the last row and column.
+            for (int i = 0; i < 16; i++) {
+                int x = bx * 4 + i % 4;
+                int y = by * 4 + i / 4;
+
+                x = x < width ? x : width - 1;
+                y = y < height ? y : height - 1;
+
+                memcpy(block[i], data + ((size_t)y * stride + x) * 3, 3);
+            }
+
+            encodeBlock(block, out + ((size_t)by * blocks_x + bx) * 8);
+        }
+    }
+}
+
+void encodeBlock(unsigned char block[16][3], unsigned char *out)
+{
+    unsigned char lo[3] = { 255, 255, 255 };
+    unsigned char hi[3] = { 0, 0, 0 };
+
+    for (int i = 0; i < 16; i++) {
+        for (int c = 0; c < 3; c++) {
+            lo[c] = block[i][c] < lo[c] ? block[i][c] : lo[c];
+            hi[c] = block[i][c] > hi[c] ? block[i][c] : hi[c];
+        }
+    }
+
+    // Pull the bounding box in a bit, the extremes are rarely hit exactly.
+    for (int c = 0; c < 3; c++) {
+        int inset = (hi[c] - lo[c]) >> 4;
+
+        lo[c] += inset;
+        hi[c] -= inset;
+    }
+
+    uint16_t c0 = packRGB565(hi);
+    uint16_t c1 = packRGB565(lo);
+    uint32_t indices = 0;
+
+    if (c0 < c1) {
+        uint16_t swap = c0;
+        c0 = c1;
+        c1 = swap;
+    }
+
+    if (c0 != c1) {
+        int palette[4][3];
+
+        for (int c = 0; c < 3; c++) {
+            int shift = c == 1 ? 5 : 11 * (c == 0);
+            int bits = c == 1 ? 6 : 5;
+            int mask = (1 << bits) - 1;
+            int a = (c0 >> shift) & mask;
+            int b = (c1 >> shift) & mask;
+
+            palette[0][c] = (a << (8 - bits)) | (a >> (2 * bits - 8));
+            palette[1][c] = (b << (8 - bits)) | (b >> (2 * bits - 8));
+            palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+            palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+        }
+
+        for (int i = 0; i < 16; i++) {
+            int best = 0;
+            int best_error = INT_MAX;
+
+            for (int p = 0; p < 4; p++) {
+                int error = 0;
+
+                for (int c = 0; c < 3; c++) {
+                    int d = block[i][c] - palette[p][c];
+                    error += d * d;
+                }
+
+                if (error < best_error) {
+                    best = p;
+                    best_error = error;
+                }
+            }
+
+            indices |= (uint32_t)best << (2 * i);
+        }
+    }
+
+    out[0] = c0 & 0xff;
+    out[1] = c0 >> 8;
+    out[2] = c1 & 0xff;
+    out[3] = c1 >> 8;
+    out[4] = indices & 0xff;
+    out[5] = (indices >> 8) & 0xff;
+    out[6] = (indices >> 16) & 0xff;
+    out[7] = indices >> 24;
+}
+
+uint16_t packRGB565(const unsigned char *rgb)
+{
+    return ((rgb[0] >> 3) << 11) | ((rgb[1] >> 2) << 5) | (rgb[2] >> 3);
+}
+
+void deleteTextures(int n, uint32_t *ids)
+{
+    for (int i = 0; i < n; i++) {
+        if (ids[i] != 0) {
+            glDeleteTextures(1, &ids[i]);
+            settings.textures--;
+            ids[i] = 0;
+        }
+    }
+}
+
+int countDescriptors()
+{
+    DIR *dir = opendir("/proc/self/fd");
+    int count = 0;
+
+    if (dir == NULL) {
+        return -1;
+    }
+
+    while (readdir(dir) != NULL) {
+        count++;
+    }
+
+    closedir(dir);
+
+    // ".", ".." and the descriptor opendir itself holds.
+    return count - 3;
+}
+
+void loadTexture(const char *current, uint32_t *id, int width, int height)
+{
+    unsigned char *data = NULL;
+    int src_width = 0;
+    int src_height = 0;
+
+    // Compressed textures cannot be rendered to, those resize on the CPU.
+    if (
+        settings.gpu &&
+        settings.nheads == 1 &&
+        settings.opengl.format == COMPRESS_NONE &&
+        gpuInit()
+    ) {
+        data = loadSource(current, width, height, &src_width, &src_height);
+    }
+
+    if (
+        data != NULL &&
+        gpuResize(id, data, src_width, src_height, width, height)
+    ) {
+        free(data);
+        trimMemory();
+        return;
+    }
+
+    free(data);
+    data = loadPixels(current, width, height);
+
+    if (data == NULL) {
+        return;
+    }
+
+    uploadTexture(id, data, width, height, width);
+
+    free(data);
+    trimMemory();
+}
+
+size_t textureBytes(struct Plane *plane)
+{
+    size_t texels = (size_t)plane->width * plane->height;
+
+    switch (settings.opengl.format) {
+        case COMPRESS_BC1:
+            return (size_t)((plane->width + 3) / 4) *
+                   ((plane->height + 3) / 4) * 8;
+
+        case COMPRESS_RGB565:
+            return texels * 2;
+
+        default:
+            // Drivers pad GL_RGB to four bytes per texel.
+            return texels * 4;
+    }
+}
+
+bool cacheEvict()
+{
+    struct Plane *oldest_plane = NULL;
+    int oldest = -1;
+
+    for (int i = 0; i < settings.nmon; i++) {
+        struct Plane *plane = &settings.planes[i];
+
+        for (int j = 0; j < plane->ncache; j++) {
+            if (
+                oldest_plane == NULL ||
+                plane->cache[j].used < oldest_plane->cache[oldest].used
+            ) {
+                oldest_plane = plane;
+                oldest = j;
+            }
+        }
+    }
+
+    if (oldest_plane == NULL) {
+        return false;
+    }
+
+    struct CacheEntry *entry = &oldest_plane->cache[oldest];
+    int head = settings.head;
+
+    usePlane(oldest_plane);
+    deleteTextures(1, &entry->texture);
+    useHead(head);
+    settings.vram_used -= entry->bytes;
+
+    oldest_plane->ncache--;
+    memmove(
+        entry,
+        entry + 1,
+        (oldest_plane->ncache - oldest) * sizeof(struct CacheEntry)
+    );
+
+    return true;
+}
+
+void cachePut(struct Plane *plane, uint32_t texture, const char *path)
+{
+    if (texture == 0) {
+        return;
+    }
+
+    usePlane(plane);
+
+    size_t bytes = textureBytes(plane);
+
+    if (path[0] == '\0' || bytes > settings.vram_budget) {
+        deleteTextures(1, &texture);
+        return;
+    }
+
+    uint32_t old = cacheTake(plane, path);
+
+    if (old != 0) {
+        deleteTextures(1, &old);
+    }
+
+    while (settings.vram_used + bytes > settings.vram_budget) {
+        if (!cacheEvict()) {
+            break;
+        }
+    }
+
+    plane->cache = realloc(
+                       plane->cache,
+                       (plane->ncache + 1) * sizeof(struct CacheEntry)
+                   );
+
+    struct CacheEntry *entry = &plane->cache[plane->ncache++];
+
+    entry->texture = texture;
+    entry->bytes = bytes;
+    entry->used = ++settings.cache_clock;
+    sprintf(entry->path, "%.*s", PATH_MAX - 1, path);
+
+    settings.vram_used += bytes;
+}
+
+bool cacheHas(struct Plane *plane, const char *path)
+{
+    for (int i = 0; i < plane->ncache; i++) {
+        if (!strcmp(plane->cache[i].path, path)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+uint32_t cacheTake(struct Plane *plane, const char *path)
+{
+    for (int i = 0; i < plane->ncache; i++) {
+        struct CacheEntry *entry = &plane->cache[i];
+
+        if (!strcmp(entry->path, path)) {
+            uint32_t texture = entry->texture;
+            settings.vram_used -= entry->bytes;
+
+            plane->ncache--;
+            memmove(
+                entry,
+                entry + 1,
+                (plane->ncache - i) * sizeof(struct CacheEntry)
+            );
+
+            return texture;
+        }
+    }
+
+    return 0;
+}
+
+void cacheFlush(struct Plane *plane)
+{
+    usePlane(plane);
+
+    for (int i = 0; i < plane->ncache; i++) {
+        deleteTextures(1, &plane->cache[i].texture);
+        settings.vram_used -= plane->cache[i].bytes;
+    }
+
+    free(plane->cache);
+
+    plane->cache = NULL;
+    plane->ncache = 0;
+}
+
+void historyPush(struct Plane *plane, const char *path)
+{
+    if (path[0] == '\0') {
+        return;
+    }
+
+    if (plane->history == NULL) {
+        plane->history = malloc(HISTORY_SIZE * PATH_MAX);
+    }
+
+    if (plane->nhistory == HISTORY_SIZE) {
+        memmove(
+            plane->history[0],
+            plane->history[1],
+            (HISTORY_SIZE - 1) * PATH_MAX
+        );
+        plane->nhistory--;
+    }
+
+    sprintf(plane->history[plane->nhistory++], "%.*s", PATH_MAX - 1, path);
+}
+
+void setImage(uint32_t *side, struct Plane *plane, const char *path)
+{
+    uint32_t cached = cacheTake(plane, path);
+
+    usePlane(plane);
+
+    if (cached != 0) {
+        if (*side != 0) {
+            deleteTextures(1, side);
+        }
+
+        *side = cached;
+        return;
+    }
+
+    // The back image has until the next fade, the front is needed now.
+    if (side == &plane->back && !settings.span) {
+        decodePush(plane - settings.planes, path, true);
+        return;
+    }
+
+    loadTexture(path, side, plane->width, plane->height);
+}
+
+bool animatedType(const char *path)
+{
+    const char *ext = strrchr(path, '.');
+
+    return ext != NULL && (
+        !strcasecmp(ext, ".gif") ||
+        !strcasecmp(ext, ".png") ||
+        !strcasecmp(ext, ".webp")
+    );
+}
+
+bool isAnimated(const char *path)
+{
+    if (!animatedType(path)) {
+        return false;
+    }
+
+    MagickWand *wand = NewMagickWand();
+    int frames = 0;
+
+    if (MagickPingImage(wand, path) != MagickFalse) {
+        frames = MagickGetNumberImages(wand);
+    }
+
+    DestroyMagickWand(wand);
+
+    return frames > 1;
+}
+
+bool animationPush(struct Animation *anim, unsigned char *data, float delay)
+{
+    pthread_mutex_lock(&anim->lock);
+
+    while (anim->running && anim->count == ANIM_RING) {
+        pthread_cond_wait(&anim->cond, &anim->lock);
+    }
+
+    if (!anim->running) {
+        pthread_mutex_unlock(&anim->lock);
+        free(data);
+
+        return false;
+    }
+
+    int slot = (anim->head + anim->count) % ANIM_RING;
+
+    anim->frames[slot] = data;
+    anim->delays[slot] = delay;
+    anim->count++;
+
+    pthread_mutex_unlock(&anim->lock);
+
+    return true;
+}
+
+void *animationWorker(void *arg)
+{
+    struct Animation *anim = arg;
+    MagickWand *canvas = NULL;
+    int frame = 0;
+    bool running = true;
+
+    lowerPriority();
+
+    // Pinging can take a while on large files, so it happens here rather
+    // than on the render thread. Still images just end the worker.
+    running = isAnimated(anim->path);
+
+    while (running) {
+        // Read a few frames at a time so memory stays bounded by
+        // ANIM_CHUNK + ANIM_RING frames no matter how long the animation is.
+        char range[PATH_MAX + 32];
+        sprintf(
+            range,
+            "%.*s[%d-%d]",
+            PATH_MAX - 1,
+            anim->path,
+            frame,
+            frame + ANIM_CHUNK - 1
+        );
+
+        MagickWand *chunk = NewMagickWand();
+        int nframes = 0;
+
+        if (MagickReadImage(chunk, range) != MagickFalse) {
+            nframes = MagickGetNumberImages(chunk);
+        }
+
+        if (nframes == 0) {
+            DestroyMagickWand(chunk);
+
+            if (frame == 0) {
+                fprintf(stderr, "Unable to animate %s\n", anim->path);
+                break;
+            }
+
+            frame = 0;
+            continue;
+        }
+
+        for (int i = 0; i < nframes && running; i++) {
+            #ifdef GraphicsMagick
+            MagickSetImageIndex(chunk, i);
+            #else
+            MagickSetIteratorIndex(chunk, i);
+            #endif
+            MagickWand *image = MagickGetImage(chunk);
+
+            size_t page_width, page_height;
+            ssize_t x, y;
+
+            MagickGetImagePage(image, &page_width, &page_height, &x, &y);
+
+            if (frame + i == 0 || canvas == NULL) {
+                if (canvas != NULL) {
+                    DestroyMagickWand(canvas);
+                }
+
+                canvas = CloneMagickWand(image);
+            } else {
+                #if ImageMagick_MajorVersion < 7 || GraphicsMagick
+                MagickCompositeImage(canvas, image, OverCompositeOp, x, y);
+                #else
+                MagickCompositeImage(
+                    canvas,
+                    image,
+                    OverCompositeOp,
+                    MagickTrue,
+                    x,
+                    y
+                );
+                #endif
+            }
+
+            float delay = MagickGetImageDelay(image) / 100.0f;
+
+            if (delay <= 0.0f) {
+                delay = ANIM_DEFAULT_DELAY;
+            }
+
+            DestroyMagickWand(image);
+
+            MagickWand *out = CloneMagickWand(canvas);
+            unsigned char *data = NULL;
+
+            if (fitImage(out, anim->width, anim->height)) {
+                data = exportPixels(out, anim->width, anim->height);
+            }
+
+            DestroyMagickWand(out);
+
+            // The first frame is already on screen, it just stays still.
+            if (data == NULL) {
+                running = false;
+                break;
+            }
 
-    Window desktop = findDesktop();
-    settings.win = XCreateWindow(
-                       settings.dpy,
-                       desktop,
-                       0,
-                       0,
-                       settings.scr->width,
-                       settings.scr->height,
-                       0,
-                       CopyFromParent,
-                       InputOutput,
-                       CopyFromParent,
-                       CWOverrideRedirect,
-                       &attr
-                   );
+            running = animationPush(anim, data, delay);
+        }
 
-    XSizeHints xsh;
-    xsh.flags  = PSize | PPosition;
-    xsh.width  = settings.scr->width;
-    xsh.height = settings.scr->height;
+        DestroyMagickWand(chunk);
 
-    XWMHints xwmh;
-    xwmh.flags = InputHint;
-    xwmh.input = 0;
+        frame = (nframes < ANIM_CHUNK) ? 0 : frame + nframes;
+    }
 
-    XSetWMProperties(
-        settings.dpy,
-        settings.win,
-        NULL,
-        NULL,
-        argv,
-        argc,
-        &xsh,
-        &xwmh,
-        NULL
-    );
+    if (canvas != NULL) {
+        DestroyMagickWand(canvas);
+    }
 
-    XClassHint hints;
+    pthread_mutex_lock(&anim->lock);
+    anim->done = true;
+    pthread_mutex_unlock(&anim->lock);
 
-    hints.res_name = "wallfade";
-    hints.res_class = "Wallfade";
+    trimMemory();
 
-    XSetClassHint(
-        settings.dpy,
-        settings.win,
-        &hints
-    );
+    return NULL;
+}
 
-    Atom state[5];
+void animationStart(int monitor)
+{
+    struct Plane *plane = &settings.planes[monitor];
 
-    state[0] = XInternAtom(settings.dpy, "_NET_WM_STATE_BELOW", 0);
-    state[1] = XInternAtom(settings.dpy, "_NET_WM_STATE_FULLSCREEN", 0);
-    state[2] = XInternAtom(settings.dpy, "_NET_WM_STATE_SKIP_PAGER", 0);
-    state[3] = XInternAtom(settings.dpy, "_NET_WM_STATE_SKIP_TASKBAR", 0);
-    state[4] = XInternAtom(settings.dpy, "_NET_WM_STATE_STICKY", 0);
+    animationStop(plane);
 
-    Atom type = XInternAtom(settings.dpy, "_NET_WM_WINDOW_TYPE_DESKTOP", 0);
+    if (settings.span || !animatedType(plane->front_path)) {
+        return;
+    }
 
-    XChangeProperty(
-        settings.dpy,
-        settings.win,
-        XInternAtom(settings.dpy, "_NET_WM_STATE", 0),
-        XA_ATOM,
-        32,
-        PropModeReplace,
-        (unsigned char *) state,
-        4
+    struct Animation *anim = calloc(1, sizeof(struct Animation));
+
+    anim->running = true;
+    anim->width = plane->width;
+    anim->height = plane->height;
+    anim->fps = settings.fps[monitor];
+    sprintf(anim->path, "%.*s", PATH_MAX - 1, plane->front_path);
+
+    pthread_mutex_init(&anim->lock, NULL);
+    pthread_cond_init(&anim->cond, NULL);
+
+    if (pthread_create(&anim->thread, NULL, animationWorker, anim) != 0) {
+        fprintf(stderr, "Unable to start animation thread\n");
+
+        pthread_cond_destroy(&anim->cond);
+        pthread_mutex_destroy(&anim->lock);
+        free(anim);
+
+        return;
+    }
+
+    plane->anim = anim;
+}
+
+void animationStop(struct Plane *plane)
+{
+    struct Animation *anim = plane->anim;
+
+    if (anim == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&anim->lock);
+    anim->running = false;
+    pthread_cond_broadcast(&anim->cond);
+    pthread_mutex_unlock(&anim->lock);
+
+    pthread_join(anim->thread, NULL);
+
+    for (int i = 0; i < anim->count; i++) {
+        free(anim->frames[(anim->head + i) % ANIM_RING]);
+    }
+
+    usePlane(plane);
+    deleteTextures(2, anim->textures);
+
+    pthread_cond_destroy(&anim->cond);
+    pthread_mutex_destroy(&anim->lock);
+    free(anim);
+
+    plane->anim = NULL;
+}
+
+float animationTick(struct Plane *plane)
+{
+    struct Animation *anim = plane->anim;
+
+    if (anim == NULL) {
+        return -1.0f;
+    }
+
+    float interval = anim->delay;
+
+    if (anim->fps > 0.0f && interval < 1.0f / anim->fps) {
+        interval = 1.0f / anim->fps;
+    }
+
+    anim->elapsed += settings.seconds;
+
+    if (anim->shown && anim->elapsed < interval) {
+        return interval - anim->elapsed;
+    }
+
+    pthread_mutex_lock(&anim->lock);
+
+    if (anim->count == 0) {
+        bool done = anim->done;
+        pthread_mutex_unlock(&anim->lock);
+
+        // A still image or a failed read, nothing more will come.
+        return done ? -1.0f : ANIM_DEFAULT_DELAY / 10.0f;
+    }
+
+    unsigned char *data = anim->frames[anim->head];
+    anim->delay = anim->delays[anim->head];
+    anim->head = (anim->head + 1) % ANIM_RING;
+    anim->count--;
+
+    pthread_cond_signal(&anim->cond);
+    pthread_mutex_unlock(&anim->lock);
+
+    // Upload into the texture that is not on screen, then flip.
+    int next = anim->shown ? anim->current ^ 1 : 0;
+
+    // Frames change too often to be worth compressing.
+    usePlane(plane);
+    uploadRaw(
+        &anim->textures[next],
+        data,
+        anim->width,
+        anim->height,
+        anim->width
     );
+    free(data);
 
-    XChangeProperty(
-        settings.dpy,
-        settings.win,
-        XInternAtom(settings.dpy, "_NET_WM_WINDOW_TYPE", 1),
-        XA_ATOM,
-        32,
-        PropModeReplace,
-        (unsigned char *) &type,
-        1
+    anim->current = next;
+    anim->elapsed = anim->shown ? fmaxf(0.0f, anim->elapsed - interval) : 0;
+    anim->shown = true;
+
+    if (anim->elapsed > anim->delay) {
+        anim->elapsed = 0;
+    }
+
+    return anim->delay - anim->elapsed;
+}
+
+uint32_t frontTexture(struct Plane *plane)
+{
+    if (plane->anim != NULL && plane->anim->shown) {
+        return plane->anim->textures[plane->anim->current];
+    }
+
+    return plane->front;
+}
+
+void randomImage(uint32_t *side, struct Plane *plane, const char *not,
+                 int monitor)
+{
+    char path[PATH_MAX];
+
+    if (nextPath(monitor, not, path)) {
+        sprintf(
+            plane->back_path,
+            "%.*s",
+            (int)sizeof(plane->back_path) - 1,
+            path
+        );
+
+        setImage(side, plane, plane->back_path);
+    }
+}
+
+void randomImages(int monitor)
+{
+    // A warm start already shows the snapshot, only the back is decoded.
+    if (settings.warm && settings.planes[monitor].front != 0) {
+        getFiles(monitor);
+    } else {
+        randomImage(
+            &settings.planes[monitor].front,
+            &settings.planes[monitor],
+            "",
+            monitor
+        );
+
+        sprintf(
+            settings.planes[monitor].front_path,
+            "%.*s",
+            PATH_MAX - 1,
+            settings.planes[monitor].back_path
+        );
+    }
+
+    emitEvent(
+        "changed %d %s\n",
+        monitor,
+        settings.planes[monitor].front_path
     );
+    animationStart(monitor);
 
-    XMapWindow(settings.dpy, settings.win);
-    XLowerWindow(settings.dpy, settings.win);
-    XSync(settings.dpy, settings.win);
+    if (settings.nfiles[monitor] > 1) {
+        randomImage(
+            &settings.planes[monitor].back,
+            &settings.planes[monitor],
+            settings.planes[monitor].front_path,
+            monitor
+        );
+    }
+}
 
-    if (!getMonitorsXRR()) {
-        if (!getMonitorsXinerama()) {
-            fprintf(stderr, "Unable to find monitors\n");
-            exit(-1);
+void spanLayout()
+{
+    int min_x = settings.planes[0].x;
+    int min_y = settings.planes[0].y;
+
+    for (int i = 1; i < settings.nmon; i++) {
+        if (settings.planes[i].x < min_x) {
+            min_x = settings.planes[i].x;
+        }
+
+        if (settings.planes[i].y < min_y) {
+            min_y = settings.planes[i].y;
         }
     }
 
-    initOpengl();
+    settings.span_width = 0;
+    settings.span_height = 0;
 
-    return 1;
+    for (int i = 0; i < settings.nmon; i++) {
+        struct Plane *plane = &settings.planes[i];
+
+        // Every distinct column/row edge to the left/above us hides
+        // settings.bezel pixels of the panorama behind a bezel.
+        int col = 0;
+        int row = 0;
+
+        for (int j = 0; j < settings.nmon; j++) {
+            bool seen_x = false;
+            bool seen_y = false;
+
+            for (int k = 0; k < j; k++) {
+                seen_x |= settings.planes[k].x == settings.planes[j].x;
+                seen_y |= settings.planes[k].y == settings.planes[j].y;
+            }
+
+            if (!seen_x && settings.planes[j].x < plane->x) {
+                col++;
+            }
+
+            if (!seen_y && settings.planes[j].y < plane->y) {
+                row++;
+            }
+        }
+
+        plane->span_x = plane->x - min_x + col * settings.bezel;
+        plane->span_y = plane->y - min_y + row * settings.bezel;
+
+        if (plane->span_x + plane->width > settings.span_width) {
+            settings.span_width = plane->span_x + plane->width;
+        }
+
+        if (plane->span_y + plane->height > settings.span_height) {
+            settings.span_height = plane->span_y + plane->height;
+        }
+    }
+
+    GLint max_size = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_size);
+
+    for (int i = 0; max_size > 0 && i < settings.nmon; i++) {
+        if (
+            settings.planes[i].width > max_size ||
+            settings.planes[i].height > max_size
+        ) {
+            fprintf(
+                stderr,
+                "Monitor %d is larger than GL_MAX_TEXTURE_SIZE (%d)\n",
+                i,
+                max_size
+            );
+        }
+    }
+
+    printf("span: %dx%d\n", settings.span_width, settings.span_height);
 }
 
-void gotsig(int signum)
+void spanImage(bool front, const char *not)
 {
-    settings.running = false;
+    char path[PATH_MAX];
+
+    if (nextPath(0, not, path)) {
+        spanSetImage(front, path);
+    }
+
+    for (int i = 0; i < settings.nmon; i++) {
+        settings.nfiles[i] = settings.nfiles[0];
+    }
 }
 
-void shutdown()
+void spanSetImage(bool front, const char *path)
 {
-    shmdt(&settings.shmem);
+    bool resident = true;
 
-    if (settings.planes) {
-        free(settings.planes);
+    for (int i = 0; i < settings.nmon; i++) {
+        resident &= cacheHas(&settings.planes[i], path);
     }
 
-    if (settings.paths) {
-        free(settings.paths);
+    // One decode for the whole wall, every plane uploads its own
+    // sub-rectangle of it.
+    unsigned char *data = NULL;
+
+    if (!resident) {
+        data = loadPixels(path, settings.span_width, settings.span_height);
+
+        if (data == NULL) {
+            emitEvent("error %s\n", path);
+            return;
+        }
     }
 
     for (int i = 0; i < settings.nmon; i++) {
-        if (settings.planes[i].front != 0) {
-            glDeleteTextures(1, &settings.planes[i].front);
+        struct Plane *plane = &settings.planes[i];
+        uint32_t *side = front ? &plane->front : &plane->back;
+
+        sprintf(
+            front ? plane->front_path : plane->back_path,
+            "%.*s",
+            PATH_MAX - 1,
+            path
+        );
+
+        if (resident) {
+            setImage(side, plane, path);
+            continue;
         }
 
-        if (settings.planes[i].back != 0) {
-            glDeleteTextures(1, &settings.planes[i].back);
+        uploadTexture(
+            side,
+            data + (
+                (size_t)plane->span_y * settings.span_width +
+                plane->span_x
+            ) * 3,
+            plane->width,
+            plane->height,
+            settings.span_width
+        );
+    }
+
+    free(data);
+    trimMemory();
+}
+
+void spanPreload(const char *path)
+{
+    unsigned char *data = loadPixels(
+                              path,
+                              settings.span_width,
+                              settings.span_height
+                          );
+
+    if (data == NULL) {
+        return;
+    }
+
+    for (int i = 0; i < settings.nmon; i++) {
+        struct Plane *plane = &settings.planes[i];
+        uint32_t texture = 0;
+
+        uploadTexture(
+            &texture,
+            data + (
+                (size_t)plane->span_y * settings.span_width +
+                plane->span_x
+            ) * 3,
+            plane->width,
+            plane->height,
+            settings.span_width
+        );
+
+        cachePut(plane, texture, path);
+    }
+
+    free(data);
+    trimMemory();
+}
+
+void randomSpan()
+{
+    if (settings.warm) {
+        getFiles(0);
+
+        for (int i = 0; i < settings.nmon; i++) {
+            settings.nfiles[i] = settings.nfiles[0];
         }
+    } else {
+        spanImage(true, "");
     }
 
-    glXDestroyContext(settings.dpy, settings.opengl.ctx);
+    for (int i = 0; i < settings.nmon; i++) {
+        emitEvent("changed %d %s\n", i, settings.planes[i].front_path);
+    }
 
-    #ifdef GraphicsMagick
-    DestroyMagick();
-    #else
-    MagickWandTerminus();
-    #endif
+    if (settings.nfiles[0] > 1) {
+        spanImage(false, settings.planes[0].front_path);
+    }
 }
 
-void drawPlane(struct Plane *plane, uint32_t texture, float alpha,bool mirror)
+bool previousImages()
 {
-    glBindTexture(GL_TEXTURE_2D, texture);
-    glBegin(GL_QUADS);
-    glTexCoord2f((float)(mirror), 0);
-    glColor4f(1, 1, 1, alpha);
-    glVertex2i(
-        plane->x,
-        plane->y
-    );
-    glTexCoord2f((float)(mirror), 1);
-    glColor4f(1, 1, 1, alpha);
-    glVertex2i(
-        plane->x,
-        plane->y + plane->height
-    );
-    glTexCoord2f((float)(!mirror), 1);
-    glColor4f(1, 1, 1, alpha);
-    glVertex2i(
-        plane->x + plane->width,
-        plane->y + plane->height
-    );
-    glTexCoord2f((float)(!mirror), 0);
-    glColor4f(1, 1, 1, alpha);
-    glVertex2i(
-        plane->x + plane->width,
-        plane->y
-    );
-    glEnd();
+    for (int i = 0; i < settings.nmon; i++) {
+        if (settings.planes[i].nhistory == 0) {
+            return false;
+        }
+    }
+
+    for (int i = 0; i < settings.nmon; i++) {
+        struct Plane *plane = &settings.planes[i];
+        const char *path = plane->history[--plane->nhistory];
+
+        cachePut(plane, plane->back, plane->back_path);
+        plane->back = 0;
+
+        sprintf(plane->back_path, "%.*s", PATH_MAX - 1, path);
+
+        if (!settings.span) {
+            setImage(&plane->back, plane, plane->back_path);
+        }
+    }
+
+    if (settings.span) {
+        spanSetImage(false, settings.planes[0].back_path);
+    }
+
+    settings.rewind = true;
+    startFade();
+
+    return true;
 }
 
-float smooth(float min, float max, float val)
+void gotoImage(const char *path)
 {
-    float out = 0;
-
-    if (settings.smoothfunction == 1) {
-        out = val; // linear
-    } else {
-        float s = fmaxf(0, fminf(1, (val - min) / (max - min)));
+    for (int i = 0; i < settings.nmon; i++) {
+        struct Plane *plane = &settings.planes[i];
 
-        switch (settings.smoothfunction) {
-            default:
-            case 2: // smoothstep
-                out = s * s * (3 - 2 * s);
-                break;
+        cachePut(plane, plane->back, plane->back_path);
+        plane->back = 0;
 
-            case 3: // smootherstep
-                out = s * s * (s * (s * 6 - 15) + 10);
-                break;
+        if (!settings.span) {
+            sprintf(plane->back_path, "%.*s", PATH_MAX - 1, path);
+            setImage(&plane->back, plane, plane->back_path);
         }
     }
 
-    return out;
+    if (settings.span) {
+        spanSetImage(false, path);
+    }
+
+    startFade();
 }
 
-void drawPlanes()
+void parseMirrors(char *mirrors)
 {
-    float alpha = 0.0f;
+    if(strlen(mirrors)) {
+        char *p = 0;
+        int monitor = 0;
+        while ((p = strsep(&mirrors, ",\0")) != NULL) {
+            growMonitors(monitor + 1);
+            settings.mirror[monitor]=atoi(p);
+            monitor++;
+        }
 
-    if (settings.fading) {
-        static float linear = 0.0f;
+        settings.quads_stale = true;
 
-        linear += settings.fade * settings.seconds;
-        alpha = smooth(0.0f, 1.0f, linear);
+    }
 
-        if (linear > 1.0f) {
-            settings.fading = false;
+}
 
-            for (int i = 0; i < settings.nmon; i++) {
-                uint32_t tmp = settings.planes[i].front;
-                settings.planes[i].front = settings.planes[i].back;
+int parsePaths(char *paths, int (*outputPtr)(const char *, ...))
+{
+    if (strlen(paths)) {
+        char *p = 0;
 
-                sprintf(
-                    settings.planes[i].front_path,
-                    "%.*s",
-                    (int)sizeof(settings.planes[i].front_path),
-                    settings.planes[i].back_path
-                );
+        while ((p = strsep(&paths, ",\0")) != NULL) {
+            char *m = 0;
 
-                settings.planes[i].back = tmp;
+            if ((m = strsep(&p, ":")) != NULL && p != NULL) {
+                int monitor = atoi(m);
 
-                randomImage(
-                    &settings.planes[i].back,
-                    &settings.planes[i],
-                    settings.planes[i].front_path,
-                    i
+                if (monitor >= 0 && monitor < settings.nmon) {
+                    sprintf(
+                        settings.paths[monitor].path,
+                        "%.*s",
+                        (int)sizeof(settings.paths[monitor].path) - 1,
+                        p
+                    );
+
+                    if (strlen(settings.default_path) == 0) {
+                        sprintf(
+                            settings.default_path,
+                            "%.*s",
+                            (int)sizeof(settings.default_path) - 1,
+                            p
+                        );
+                    }
+                } else {
+                    fprintf(stderr, "Monitor %d not found.\n", monitor);
+                }
+            } else if (m != NULL) {
+                sprintf(
+                    settings.default_path,
+                    "%.*s",
+                    (int)sizeof(settings.default_path) - 1,
+                    m
                 );
             }
-
-            linear = 0.0f;
-            alpha = 0.0f;
         }
     }
 
+    if (strlen(settings.default_path)) {
+        outputPtr("Default path: %s\n", settings.default_path);
+    }
+
     for (int i = 0; i < settings.nmon; i++) {
-        if (settings.nfiles[i]) {
-            if (settings.nfiles[i] > 1) {
-                drawPlane(
-                    &settings.planes[i],
-                    settings.planes[i].back,
-                    1.0f,
-                    settings.mirror[i]
-                );
-                drawPlane(
-                    &settings.planes[i],
-                    settings.planes[i].front,
-                    1.0f - alpha,
-                    settings.mirror[i]
-                );
-            } else {
-                drawPlane(
-                    &settings.planes[i],
-                    settings.planes[i].front,
-                    1.0f,
-                    settings.mirror[i]
-                );
-                randomImage(
-                    &settings.planes[i].back,
-                    &settings.planes[i],
-                    settings.planes[i].front_path,
-                    i
-                );
-                usleep(500000);
-            }
-        }  else {
-            randomImages(i);
-            usleep(500000);
+        if (!normalizePath(i, outputPtr)) {
+            return 0;
         }
     }
+
+    return 1;
 }
 
-int messageRespond(const char *format, ...)
+int normalizePath(int monitor, int (*outputPtr)(const char *, ...))
 {
-    while (settings.shmem[0] == MSG_PARENT) {
-        usleep(10000);
+    char *path = settings.paths[monitor].path;
+    int len = strlen(path);
+    int suffix = strlen(GLOB_SUFFIX);
+
+    if (len >= suffix && !strcmp(path + len - suffix, GLOB_SUFFIX)) {
+        return 1;
+    }
+
+    if (len == 0) {
+        if (strlen(settings.default_path)) {
+            sprintf(
+                path,
+                "%.*s",
+                (int)sizeof(settings.paths[monitor].path),
+                settings.default_path
+            );
+
+            len = strlen(settings.default_path);
+        } else {
+            fprintf(
+                stderr,
+                "Tried to set default path but none was specified!\n"
+            );
+            settings.running = false;
+            return 0;
+        }
     }
 
-    char output[MEM_SIZE] = {0};
+    outputPtr("Monitor %d path: %s\n", monitor, path);
+
+    if (path[len - 1] != '/') {
+        sprintf(
+            path + len,
+            "%.*s",
+            (int)sizeof(settings.paths[monitor].path) - len,
+            "/"
+        );
+
+        len = strlen(path);
+    }
 
-    va_list args;
-    va_start(args, format);
-    vsprintf(output, format, args);
     sprintf(
-        settings.shmem,
-        "%c%.*s",
-        MSG_PARENT,
-        MEM_SIZE,
-        output
+        path + len,
+        "%.*s",
+        (int)sizeof(settings.paths[monitor].path) - len,
+        GLOB_SUFFIX
     );
 
-    printf("%s",output);
-    va_end(args);
+    return 1;
+}
 
-    return 0;
+void help(const char *filename)
+{
+    printf("Usage: %s [options]\n", filename);
+    printf("    -f, fade    : fade time (default 1.0s)\n");
+    printf("    -i, idle    : idle time (default 3s)\n");
+    printf("    -s, smooth  : smoothing function to use when fading.\n");
+    printf("                    1: linear\n");
+    printf("                    2: smoothstep (default)\n");
+    printf("                    3: smootherstep\n");
+    printf("\n");
+    printf("    -p, paths   : wallpapers paths.\n");
+    printf("                    use monitor:path, if no monitor is\n");
+    printf("                    specified the path will be used as\n");
+    printf("                    the default path\n");
+    printf("\n");
+    printf("                    example: -p 0:path,1:path,path\n");
+    printf("\n");
+    printf("    -l, lower   : finds and lowers window by classname (e.g. Conky)\n");
+    printf("    -c, center  : center wallpapers\n");
+    printf("    -S, span    : span one wallpaper across all monitors\n");
+    printf("    -b, bezel   : pixels hidden behind each bezel in span mode\n");
+    printf("    -o, order   : random (default), sequential (oldest first),\n");
+    printf("                  sorted (by name) or shuffle\n");
+    printf("    -P, precache: resize all images into the disk cache and exit\n");
+    printf("    -g, geometry: monitors for -P without X (e.g. 1920x1080,2560x1440)\n");
+    printf("    -m, message : send message to running process (-m help)\n");
+    printf("    -h, help    : help\n");
+    printf("\n");
 }
 
-void checkMessages()
+const char *getHomeDir()
 {
-    if (
-        settings.shmem[0] != MSG_NONE &&
-        settings.shmem[0] != MSG_PARENT &&
-        settings.shmem[0] != MSG_DONE
-    ) {
-        char *tmpstr = strdup(settings.shmem);
-        char separator[3] = " \0";
+    const char *homedir = getenv("HOME");
 
-        char *token = strtok(tmpstr, separator);
+    if (homedir != 0) {
+        return homedir;
+    }
 
-        while (token != 0) {
-            char *command = strdup(token);
+    struct passwd *result = getpwuid(getuid());
 
-            if (MESSAGE(command, "help")) {
-                char output[MEM_SIZE] = {0};
-                int len = 0;
+    if (result == 0) {
+        fprintf(stderr, "Unable to find home-directory\n");
+        exit(EXIT_FAILURE);
+    }
 
-                len += sprintf(output + len, "wallfade messages:\n");
-                len += sprintf(output + len, "\tcurrent : display current wallpapers\n");
-                len += sprintf(output + len,
-                               "\tnext    : force wallfade to change wallpapers\n");
-                len += sprintf(output + len, "\tfade    : set fade time\n");
-                len += sprintf(output + len, "\tidle    : set idle time\n");
-                len += sprintf(output + len, "\tsmooth  : change smoothfunction\n");
-                len += sprintf(output + len, "\tpaths   : change paths\n");
-                len += sprintf(output + len, "\tconfig  : print current config\n");
+    homedir = result->pw_dir;
 
-                messageRespond(output);
-                break;
-            } else if (MESSAGE(command, "current")) {
-                char output[MEM_SIZE] = {0};
+    return homedir;
+}
 
-                for (int i = 0; i < settings.nmon; i++) {
-                    char line[256] = {0};
+bool fileExists(const char *name)
+{
+    struct stat buffer;
+    return (stat(name, &buffer) == 0);
+}
 
-                    sprintf(
-                        line,
-                        "Monitor %d: %.*s\n",
-                        i,
-                        100,
-                        settings.planes[i].front_path
-                    );
+void loadConfig()
+{
+    dictionary *ini = 0;
+    char filename[PATH_MAX] = {0};
+    char file[255] = {"/wallfade.ini"};
 
-                    int len = strlen(output);
-                    sprintf(output + len, "%.*s", MEM_SIZE - len, line);
-                }
+    const char *confdir = getenv("XDG_CONFIG_HOME");
 
-                messageRespond(output);
-            } else if (MESSAGE(command, "paths")) {
-                token = strtok(0, separator);
+    if (confdir == 0) {
+        sprintf(file, "/.wallfade.ini");
+        confdir = getHomeDir();
+    } else {
+        sprintf(filename, "%s%s", confdir, file);
 
-                if (token != 0) {
-                    for (int i = 0; i < settings.nmon; i++) {
-                        memset(settings.paths[i].path, 0, PATH_MAX);
-                    }
+        if (!fileExists(filename)) {
+            sprintf(file, "/.wallfade.ini");
+            confdir = getHomeDir();
+        }
+    }
 
-                    parsePaths(token, messageRespond);
-                } else {
-                    char output[MEM_SIZE] = {0};
+    sprintf(filename, "%s%s", confdir, file);
 
-                    for (int i = 0; i < settings.nmon; i++) {
-                        char line[256] = {0};
-
-                        if (strlen(settings.paths[i].path) > 0) {
-                            sprintf(
-                                line,
-                                "Monitor %d: %.*s\n",
-                                i,
-                                100,
-                                settings.paths[i].path
-                            );
-                        } else {
-                            sprintf(
-                                line,
-                                "Monitor %d: %.*s\n",
-                                i,
-                                100,
-                                settings.default_path
-                            );
-                        }
-
-                        int len = strlen(output);
-                        sprintf(output + len, "%.*s", MEM_SIZE - len, line);
-                    }
+    if (!fileExists(filename)) {
+        sprintf(filename, "./wallfade.ini"); // Useful when debugging
+    }
 
-                    messageRespond(output);
-                }
+    sprintf(settings.config_path, "%.*s", PATH_MAX - 1, filename);
 
-                break;
-            } else if (MESSAGE(command, "next")) {
-                settings.fading = true;
-                settings.timer = 0;
+    if (fileExists(filename)) {
+        ini = iniparser_load(filename);
+    }
 
-                messageRespond("forcing next wallpapers\n");
-            } else if (MESSAGE(command, "fade")) {
-                token = strtok(0, separator);
+    settings.smoothfunction = iniparser_getint(ini, "settings:smooth", 2);
+    settings.idle = iniparser_getint(ini, "settings:idle", DEFAULT_IDLE_TIME);
+    settings.fade = iniparser_getdouble(ini, "settings:fade", DEFAULT_FADE_TIME);
+    settings.fade = 1.0f / settings.fade;
+    settings.center = iniparser_getboolean(ini, "settings:center", false);
+    settings.span = iniparser_getboolean(ini, "settings:span", false);
+    settings.bezel = iniparser_getint(ini, "settings:bezel", 0);
+    settings.order = parseOrder(
+                         iniparser_getstring(ini, "settings:order", "random")
+                     );
+    settings.preload = iniparser_getint(ini, "settings:preload", 0);
+    settings.prefetch = iniparser_getint(ini, "settings:prefetch", 0);
+    settings.prefetch_rate = iniparser_getint(ini, "settings:prefetch_rate", 0);
+    settings.budget = iniparser_getdouble(ini, "settings:budget", 0);
+    settings.shared_size = (size_t)iniparser_getint(
+                               ini,
+                               "settings:shared",
+                               0
+                           ) << 20;
+    settings.prefetch_timeout = iniparser_getint(
+                                    ini,
+                                    "settings:prefetch_timeout",
+                                    DEFAULT_PREFETCH_TIMEOUT
+                                );
+    settings.vram_budget = (size_t)iniparser_getint(
+                               ini,
+                               "settings:vram",
+                               DEFAULT_VRAM
+                           ) << 20;
+    settings.memory = (size_t)iniparser_getint(ini, "settings:memory", 0) << 20;
+    settings.stream = (uint64_t)iniparser_getint(
+                          ini,
+                          "settings:stream",
+                          DEFAULT_STREAM
+                      ) * 1000000;
+    settings.threads = iniparser_getint(ini, "settings:threads", 0);
+    settings.gpu = iniparser_getboolean(ini, "settings:gpu", false);
+    settings.screens = iniparser_getboolean(ini, "settings:screens", false);
+    settings.filter = parseFilter(
+                          iniparser_getstring(ini, "settings:filter", "gaussian"),
+                          GaussianFilter
+                      );
+    settings.draft = parseFilter(
+                         iniparser_getstring(ini, "settings:draft", "none"),
+                         UndefinedFilter
+                     );
+    settings.draft_time = iniparser_getdouble(ini, "settings:draft_time", 0);
+    settings.compress = parseCompress(
+                            iniparser_getstring(ini, "settings:compress", "none")
+                        );
 
-                if (token != 0 && isdigit(token[0])) {
-                    settings.fade = 1.0f / strtof(token, 0);
-                    messageRespond("setting %s to %s\n", command, token);
-                } else {
-                    messageRespond(
-                        "%s is set to %.2f\n",
-                        command,
-                        1.0f / settings.fade
-                    );
-                    break;
-                }
-            } else if (MESSAGE(command, "idle")) {
-                token = strtok(0, separator);
+    // "none" only makes sense for the draft, the final resize needs one.
+    if (settings.filter == UndefinedFilter) {
+        settings.filter = GaussianFilter;
+    }
+    strcpy(settings.lower, iniparser_getstring(ini, "settings:lower", "\0"));
 
-                if (token != 0 && isdigit(token[0])) {
-                    settings.idle = strtol(token, 0, 10);
-                    messageRespond("setting %s to %s\n", command, token);
-                } else {
-                    messageRespond(
-                        "%s is set to %d\n",
-                        command,
-                        settings.idle
-                    );
-                    break;
-                }
-            } else if (MESSAGE(command, "smooth")) {
-                token = strtok(0, separator);
+    strcpy(
+        settings.default_path,
+        iniparser_getstring(ini, "paths:default", "\0")
+    );
 
-                if (token != 0 && isdigit(token[0])) {
-                    settings.smoothfunction = strtol(token, 0, 10);
-                    messageRespond("setting %s to %s\n", command, token);
-                } else {
-                    messageRespond(
-                        "%s is set to %d\n",
-                        command,
-                        settings.smoothfunction
-                    );
-                    break;
-                }
-            } else if (MESSAGE(command, "config")) {
-                printConfig();
-            } else {
-                messageRespond("Unknown command \"%s\"\n", token);
-                break;
-            }
+    settings.default_fps = iniparser_getdouble(ini, "settings:fps", 0);
+    settings.workers = iniparser_getint(ini, "settings:workers", 0);
 
-            if (command) {
-                free(command);
-            }
+    // Any monitorN key counts, video walls go well past a handful.
+    int npaths = monitorKeys(ini, "paths");
+    int nmirrors = monitorKeys(ini, "mirror");
+    int nfps = monitorKeys(ini, "fps");
+    int count = MAX(npaths, MAX(nmirrors, nfps));
 
-            token = strtok(0, separator);
-        }
+    growMonitors(count);
+
+    for (int i = 0; i < settings.npaths; i += 1) {
+        char monitor[256] = {0};
+        sprintf(monitor, "paths:monitor%d", i);
+        strcpy(settings.paths[i].path, iniparser_getstring(ini, monitor, "\0"));
 
-        if (tmpstr) {
-            free(tmpstr);
+        if (strlen(settings.default_path) == 0) {
+            strcpy(settings.default_path, settings.paths[i].path);
         }
+        char mirror[256] = {0};
+        sprintf(mirror, "mirror:monitor%d", i);
+        settings.mirror[i] = iniparser_getboolean(ini, mirror, 0);
 
-        settings.shmem[0] = MSG_DONE;
+        char fps[256] = {0};
+        sprintf(fps, "fps:monitor%d", i);
+        settings.fps[i] = iniparser_getdouble(ini, fps, settings.default_fps);
     }
+
+    settings.quads_stale = true;
+    iniparser_freedict(ini);
 }
 
-void update()
+void growMonitors(int count)
 {
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-    glMatrixMode(GL_MODELVIEW);
-    glLoadIdentity();
+    if (count <= settings.npaths) {
+        return;
+    }
 
-    drawPlanes();
+    settings.paths = realloc(settings.paths, count * sizeof(struct Path));
+    settings.mirror = realloc(settings.mirror, count * sizeof(bool));
+    settings.fps = realloc(settings.fps, count * sizeof(float));
 
-    glXSwapBuffers(settings.dpy, settings.win);
+    for (int i = settings.npaths; i < count; i++) {
+        settings.paths[i].path[0] = '\0';
+        settings.mirror[i] = false;
+        settings.fps[i] = settings.default_fps;
+    }
 
-    XFlush(settings.dpy);
+    settings.npaths = count;
+}
 
-    settings.seconds = getDeltaTime();
+int monitorKeys(dictionary *ini, const char *section)
+{
+    int nkeys = ini != NULL ? iniparser_getsecnkeys(ini, section) : 0;
+    int count = 0;
 
-    if (settings.timer >= settings.idle) {
-        settings.fading = true;
-        settings.timer = 0;
+    if (nkeys <= 0) {
+        return 0;
     }
 
-    if (!settings.fading) {
-        settings.timer += settings.seconds;
-        usleep(50000);
+    const char **keys = malloc(nkeys * sizeof(char *));
+
+    if (iniparser_getseckeys(ini, section, keys) != NULL) {
+        for (int i = 0; i < nkeys; i++) {
+            const char *key = strchr(keys[i], ':');
+            int monitor = -1;
+
+            if (key != NULL && sscanf(key, ":monitor%d", &monitor) == 1) {
+                count = MAX(count, monitor + 1);
+            }
+        }
     }
 
-    usleep(50000);
+    free(keys);
 
-    checkMessages();
+    return count;
 }
 
-char **getFiles(int monitor, int *total_files)
+bool watchConfig()
 {
-    char **files = 0;
+    settings.inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
 
-    glob_t globbuf;
-
-    int err = glob(
-                  settings.paths[monitor].path,
-                  GLOB_BRACE | GLOB_TILDE,
-                  NULL,
-                  &globbuf
-              );
-
-    settings.nfiles[monitor] = 0;
-
-    if (err == 0) {
-        files = malloc((globbuf.gl_pathc + 1) * sizeof(char *));
-        *total_files = globbuf.gl_pathc;
-
-        size_t i;
-        int nfiles = 0;
+    if (settings.inotify < 0) {
+        return false;
+    }
 
-        #pragma omp parallel for private(i) reduction(+:nfiles)
+    // Editors replace the file instead of writing it, watch the directory.
+    char *dir = strdup(settings.config_path);
 
-        for (i = 0; i < globbuf.gl_pathc; i++) {
-            char *file = realpath(globbuf.gl_pathv[i], NULL);
+    int wd = inotify_add_watch(
+                 settings.inotify,
+                 dirname(dir),
+                 IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE
+             );
 
-            if (file == NULL) {
-                fprintf(
-                    stderr,
-                    "Unable to resolve realpath for %s",
-                    globbuf.gl_pathv[i]
-                );
-            } else {
-                files[i] = malloc(PATH_MAX);
-                sprintf(files[i], "%.*s", PATH_MAX - 1, file);
-                nfiles++;
+    free(dir);
 
-                free(file);
-            }
-        }
+    if (wd < 0) {
+        close(settings.inotify);
+        settings.inotify = -1;
 
-        settings.nfiles[monitor] = nfiles;
-        globfree(&globbuf);
+        return false;
     }
 
-    return files;
+    return watchFd(
+               settings.inotify,
+               EPOLLIN,
+               &settings.inotify,
+               EPOLL_CTL_ADD
+           );
 }
 
-void cleanFiles(char **files, int total_files)
+void configChanged()
 {
-    if (total_files) {
-        for (int i = 0; i < total_files; i++) {
-            free(files[i]);
-        }
+    char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    char *file = strdup(settings.config_path);
+    const char *name = basename(file);
+    bool changed = false;
+    ssize_t len;
+
+    while ((len = read(settings.inotify, buffer, sizeof(buffer))) > 0) {
+        for (char *ptr = buffer; ptr < buffer + len;) {
+            struct inotify_event *ev = (struct inotify_event *)ptr;
+
+            if (ev->len > 0 && !strcmp(ev->name, name)) {
+                changed = true;
+            }
 
-        free(files);
+            ptr += sizeof(struct inotify_event) + ev->len;
+        }
     }
-}
 
-void ThrowWandException(MagickWand *wand)
-{
-    char *description;
-    ExceptionType severity;
+    free(file);
 
-    description = MagickGetException(wand, &severity);
-    fprintf(stderr, "Wand Error: %s\n", description);
-    MagickRelinquishMemory(description);
-    exit(-1);
+    if (changed) {
+        reloadConfig();
+    }
 }
 
-MagickWand *doMagick(const char *current, int width, int height)
+void reloadConfig()
 {
-    MagickWand *wand = NewMagickWand();
+    struct _settings old = settings;
+    struct Path *old_paths = malloc(settings.npaths * sizeof(struct Path));
+    bool *old_mirror = malloc(settings.npaths * sizeof(bool));
+    float *old_fps = malloc(settings.npaths * sizeof(float));
+
+    memcpy(old_paths, settings.paths, settings.npaths * sizeof(struct Path));
+    memcpy(old_mirror, settings.mirror, settings.npaths * sizeof(bool));
+    memcpy(old_fps, settings.fps, settings.npaths * sizeof(float));
+
+    printf("Reloading %s\n", settings.config_path);
+    loadConfig();
+    keepOverrides(&old, old_paths, old_mirror);
+
+    char empty[1] = "";
+
+    if (settings.order < 0 || !parsePaths(empty, printf)) {
+        fprintf(stderr, "Invalid config, keeping the old one\n");
+
+        // loadConfig may have grown the per-monitor arrays, keep those.
+        struct Path *paths = settings.paths;
+        bool *mirror = settings.mirror;
+        float *fps = settings.fps;
+        int npaths = settings.npaths;
+
+        settings = old;
+        settings.paths = paths;
+        settings.mirror = mirror;
+        settings.fps = fps;
+        settings.npaths = npaths;
+
+        for (int i = old.npaths; i < npaths; i++) {
+            paths[i].path[0] = '\0';
+            mirror[i] = false;
+            fps[i] = old.default_fps;
+        }
 
-    int status = MagickReadImage(wand, current);
+        memcpy(paths, old_paths, old.npaths * sizeof(struct Path));
+        memcpy(mirror, old_mirror, old.npaths * sizeof(bool));
+        memcpy(fps, old_fps, old.npaths * sizeof(float));
+        free(old_paths);
+        free(old_mirror);
+        free(old_fps);
 
-    if (status == MagickFalse) {
-        ThrowWandException(wand);
+        return;
     }
 
-    status = MagickSetImageGravity(wand, CenterGravity);
+    free(old_mirror);
+    free(old_fps);
 
-    if (status == MagickFalse) {
-        ThrowWandException(wand);
+    if (old.fade != settings.fade) {
+        emitEvent("config fade %.2f\n", 1.0f / settings.fade);
     }
 
-    int orig_height = MagickGetImageHeight(wand);
-    int orig_width = MagickGetImageWidth(wand);
-
-    int newheight = orig_height;
-    int newwidth = orig_width;
-    double screen_aspect = (double)width / (double)height;
-    double image_aspect = (double)orig_width / (double)orig_height;
-
-    if (screen_aspect < image_aspect) {
-        newwidth = (int)((double)orig_height * screen_aspect);
-    } else {
-        newheight = (int)((double)orig_width / screen_aspect);
+    if (old.idle != settings.idle) {
+        emitEvent("config idle %d\n", settings.idle);
     }
 
-    if (settings.center) {
-        status = MagickCropImage(
-                     wand,
-                     newwidth,
-                     newheight,
-                     (orig_width - newwidth) / 2,
-                     (orig_height - newheight) / 2
-                 );
-    } else {
-        status = MagickCropImage(wand, newwidth, newheight, 0, 0);
+    if (old.smoothfunction != settings.smoothfunction) {
+        emitEvent("config smooth %d\n", settings.smoothfunction);
     }
 
-    if (status == MagickFalse) {
-        ThrowWandException(wand);
+    if (old.order != settings.order) {
+        for (int i = 0; settings.index && i < settings.nmon; i++) {
+            cleanFiles(&settings.index[i]);
+            clearLookahead(i);
+        }
     }
 
-    #if ImageMagick_MajorVersion < 7 || GraphicsMagick
-    MagickResizeImage(wand, width, height, GaussianFilter, 1.0);
-    #else
-    MagickResizeImage(wand, width, height, GaussianFilter);
-    #endif
+    while (settings.vram_used > settings.vram_budget && cacheEvict());
 
-    if (status == MagickFalse) {
-        ThrowWandException(wand);
+    if (
+        old.memory != settings.memory ||
+        old.threads != settings.threads
+    ) {
+        limitMemory();
     }
 
-    return wand;
-}
+    if (strcmp(old.lower, settings.lower)) {
+        findLower();
+    }
 
-void loadTexture(const char *current, uint32_t *id, int width, int height)
-{
-    MagickWand *wand = doMagick(current, width, height);
+    for (int i = 0; i < settings.nmon; i++) {
+        if (settings.planes[i].anim != NULL) {
+            settings.planes[i].anim->fps = settings.fps[i];
+        }
+    }
 
-    unsigned char *data = malloc((width * height) * 3);
-    #ifdef GraphicsMagick
-    int status = MagickGetImagePixels(
-                     wand,
-                     0,
-                     0,
-                     width,
-                     height,
-                     "RGB",
-                     CharPixel,
-                     data
-                 );
-    #else
-    int status = MagickExportImagePixels(
-                     wand,
-                     0,
-                     0,
-                     width,
-                     height,
-                     "RGB",
-                     CharPixel,
-                     data
-                 );
-    #endif
+    // Only a different crop invalidates what is already decoded.
+    bool recrop = (
+                      old.center != settings.center ||
+                      old.span != settings.span ||
+                      old.bezel != settings.bezel
+                  );
+
+    if (recrop) {
+        for (int i = 0; i < settings.nmon; i++) {
+            cacheFlush(&settings.planes[i]);
+            clearLookahead(i);
+        }
 
-    if (status == MagickFalse) {
-        ThrowWandException(wand);
+        if (settings.span) {
+            spanLayout();
+        }
     }
 
-    if (*id != 0) {
-        glBindTexture(GL_TEXTURE_2D, *id);
+    for (int i = 0; i < settings.nmon; i++) {
+        bool moved = strcmp(old_paths[i].path, settings.paths[i].path);
 
-        glTexSubImage2D(
-            GL_TEXTURE_2D,
-            0,
-            0,
-            0,
-            width,
-            height,
-            GL_RGB,
-            GL_UNSIGNED_BYTE,
-            data
-        );
-    } else {
-        glGenTextures(1, id);
-        glBindTexture(GL_TEXTURE_2D, *id);
+        if (moved) {
+            clearLookahead(i);
+        }
 
-        glTexImage2D(
-            GL_TEXTURE_2D,
-            0,
-            GL_RGB,
-            width,
-            height,
-            0,
-            GL_RGB,
-            GL_UNSIGNED_BYTE,
-            data
-        );
-    }
+        // A running fade picks the new back image when it ends.
+        if (settings.fading || settings.span || !(moved || recrop)) {
+            continue;
+        }
 
-    DestroyMagickWand(wand);
+        printf("Reloading monitor %d\n", i);
 
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        randomImage(
+            &settings.planes[i].back,
+            &settings.planes[i],
+            settings.planes[i].front_path,
+            i
+        );
+    }
 
-    glBindTexture(GL_TEXTURE_2D, 0);
+    if (
+        !settings.fading &&
+        settings.span &&
+        (recrop || strcmp(old_paths[0].path, settings.paths[0].path))
+    ) {
+        spanImage(false, settings.planes[0].front_path);
+    }
 
-    MagickRelinquishMemory(data);
+    emitEvent("config reload\n");
+    free(old_paths);
 }
 
-void randomImage(uint32_t *side, struct Plane *plane, const char *not,
-                 int monitor)
+void keepOverrides(const struct _settings *old, const struct Path *paths,
+                   const bool *mirror)
 {
-    int total_files = 0;
-    char **files = getFiles(monitor, &total_files);
+    unsigned overrides = settings.overrides;
 
-    if (settings.nfiles[monitor] > 0) {
-        int bkrand = 0;
+    if (overrides & OVERRIDE_FADE) {
+        settings.fade = old->fade;
+    }
 
-        do {
-            bkrand = random() % settings.nfiles[monitor];
-        } while (
-            strcmp(files[bkrand], not) == 0 &&
-            settings.nfiles[monitor] != 1
-        );
+    if (overrides & OVERRIDE_IDLE) {
+        settings.idle = old->idle;
+    }
 
-        sprintf(
-            plane->back_path,
-            "%.*s",
-            (int)sizeof(plane->back_path) - 1,
-            files[bkrand]
-        );
+    if (overrides & OVERRIDE_SMOOTH) {
+        settings.smoothfunction = old->smoothfunction;
+    }
 
-        loadTexture(
-            plane->back_path,
-            side,
-            plane->width,
-            plane->height
-        );
+    if (overrides & OVERRIDE_CENTER) {
+        settings.center = old->center;
+    }
 
+    if (overrides & OVERRIDE_SPAN) {
+        settings.span = old->span;
     }
 
-    cleanFiles(files, total_files);
-}
+    if (overrides & OVERRIDE_BEZEL) {
+        settings.bezel = old->bezel;
+    }
 
-void randomImages(int monitor)
-{
-    randomImage(
-        &settings.planes[monitor].front,
-        &settings.planes[monitor],
-        "",
-        monitor
-    );
+    if (overrides & OVERRIDE_ORDER) {
+        settings.order = old->order;
+    }
 
-    if (settings.nfiles[monitor] > 1) {
-        randomImage(
-            &settings.planes[monitor].back,
-            &settings.planes[monitor],
-            settings.planes[monitor].front_path,
-            monitor
-        );
+    if (overrides & OVERRIDE_LOWER) {
+        memcpy(settings.lower, old->lower, PATH_MAX);
     }
-}
 
-void parseMirrors(char *mirrors)
-{
-    if(strlen(mirrors)) {
-        char *p = 0;
-        int monitor = 0;
-        while ((p = strsep(&mirrors, ",\0")) != NULL) {
-            settings.mirror[monitor]=atoi(p);
-            monitor++;
-            if(monitor>=MAX_MONITORS) break;
+    if (overrides & OVERRIDE_PATHS) {
+        memcpy(settings.default_path, old->default_path, PATH_MAX);
+
+        for (int i = 0; i < settings.npaths; i++) {
+            if (i < old->npaths) {
+                settings.paths[i] = paths[i];
+            } else {
+                settings.paths[i].path[0] = '\0';
+            }
+        }
+    }
+
+    if (overrides & OVERRIDE_MIRROR) {
+        for (int i = 0; i < settings.npaths; i++) {
+            settings.mirror[i] = i < old->npaths && mirror[i];
         }
+    }
+
+    // Only read at startup, keep reporting what is actually in use.
+    if (settings.screens != old->screens) {
+        printf("screens only changes after a restart\n");
+        settings.screens = old->screens;
+    }
+
+    if (settings.compress != old->compress) {
+        printf("compress only changes after a restart\n");
+        settings.compress = old->compress;
+    }
+
+    if (settings.shared_size != old->shared_size) {
+        printf("shared only changes after a restart\n");
+        settings.shared_size = old->shared_size;
+    }
 
+    if (settings.gpu != old->gpu) {
+        printf("gpu only changes after a restart\n");
+        settings.gpu = old->gpu;
     }
 
+    if (settings.stream != old->stream) {
+        printf("stream only changes after a restart\n");
+        settings.stream = old->stream;
+    }
 }
 
-int parsePaths(char *paths, int (*outputPtr)(const char *, ...))
+void printConfig()
 {
-    if (strlen(paths)) {
-        char *p = 0;
+    messageRespond("[SETTINGS]\n");
+    messageRespond("smooth = %i\n", settings.smoothfunction);
+    messageRespond("idle = %i\n", settings.idle);
+    messageRespond("fade = %f\n", 1.0f / settings.fade);
+    messageRespond("center = %s\n", settings.center ? "TRUE" : "FALSE");
+    messageRespond("span = %s\n", settings.span ? "TRUE" : "FALSE");
+    messageRespond("bezel = %i\n", settings.bezel);
+    messageRespond("vram = %zu\n", settings.vram_budget >> 20);
+    messageRespond("memory = %zu\n", settings.memory >> 20);
+    messageRespond("threads = %i\n", settings.threads);
+    messageRespond("workers = %i\n", settings.workers);
+    messageRespond("stream = %i\n", (int)(settings.stream / 1000000));
+    messageRespond("gpu = %s\n", settings.gpu ? "TRUE" : "FALSE");
+    messageRespond("screens = %s\n", settings.screens ? "TRUE" : "FALSE");
+    messageRespond("filter = %s\n", filterName(settings.filter));
+    messageRespond("draft = %s\n", filterName(settings.draft));
+    messageRespond("draft_time = %.2f\n", settings.draft_time);
+    messageRespond("compress = %s\n", compressName(settings.compress));
+    messageRespond("order = %s\n", orderName(settings.order));
+    messageRespond("preload = %i\n", settings.preload);
+    messageRespond("budget = %.2f\n", settings.budget);
+    messageRespond("shared = %zu\n", settings.shared_size >> 20);
+    messageRespond("prefetch = %i\n", settings.prefetch);
+    messageRespond("prefetch_rate = %i\n", settings.prefetch_rate);
+    messageRespond("prefetch_timeout = %i\n", settings.prefetch_timeout);
 
-        while ((p = strsep(&paths, ",\0")) != NULL) {
-            char *m = 0;
+    if (settings.lower[0] != 0) {
+        messageRespond("lower = %s\n", settings.lower);
+    }
 
-            if ((m = strsep(&p, ":")) != NULL && p != NULL) {
-                int monitor = atoi(m);
+    messageRespond("\n[PATHS]\n");
 
-                if (monitor >= 0 && monitor < settings.nmon) {
-                    sprintf(
-                        settings.paths[monitor].path,
-                        "%.*s",
-                        (int)sizeof(settings.paths[monitor].path) - 1,
-                        p
-                    );
+    if (settings.default_path[0] != 0) {
+        char *dironly = strdup(settings.default_path);
+        dironly = dirname(dironly);
+        messageRespond("default = \"%s\"\n", dironly);
+        free(dironly);
+    }
 
-                    if (strlen(settings.default_path) == 0) {
-                        sprintf(
-                            settings.default_path,
-                            "%.*s",
-                            (int)sizeof(settings.default_path) - 1,
-                            p
-                        );
-                    }
-                } else {
-                    fprintf(stderr, "Monitor %d not found.\n", monitor);
-                }
-            } else if (m != NULL) {
-                sprintf(
-                    settings.default_path,
-                    "%.*s",
-                    (int)sizeof(settings.default_path) - 1,
-                    m
-                );
-            }
+    for (int i = 0; i < settings.npaths; i++) {
+        if (settings.paths[i].path[0] != 0) {
+            char *dironly = strdup(settings.paths[i].path);
+            dironly = dirname(dironly);
+            messageRespond("monitor%i = \"%s\"\n", i, dironly);
+            free(dironly);
+        }
+    }
+    messageRespond("\n[MIRROR]\n");
+    for(int i = 0; i < settings.npaths; i++) {
+        messageRespond("monitor%i = %s\n",i , settings.mirror[i] ? "TRUE" : "FALSE");
+    }
+
+    messageRespond("\n[FPS]\n");
+    for (int i = 0; i < settings.npaths; i++) {
+        messageRespond("monitor%i = %.1f\n", i, settings.fps[i]);
+    }
+}
+
+void printStats()
+{
+    for (int i = 0; i < settings.nmon; i++) {
+        struct Plane *plane = &settings.planes[i];
+        size_t bytes = 0;
+
+        for (int j = 0; j < plane->ncache; j++) {
+            bytes += plane->cache[j].bytes;
         }
-    }
 
-    if (strlen(settings.default_path)) {
-        outputPtr("Default path: %s\n", settings.default_path);
+        size_t upload = textureBytes(plane);
+        size_t vram = bytes + upload * ((plane->front != 0) + (plane->back != 0));
+
+        messageRespond(
+            "Monitor %d: %d cached, %.1f MiB, %d in history, "
+            "%.1f MiB VRAM, %.1f MiB per upload\n",
+            i,
+            plane->ncache,
+            bytes / 1048576.0,
+            plane->nhistory,
+            vram / 1048576.0,
+            upload / 1048576.0
+        );
     }
 
-    for (int i = 0; i < settings.nmon; i++) {
-        int len = strlen(settings.paths[i].path);
+    messageRespond("Textures: %s\n", compressName(settings.opengl.format));
 
-        if (len == 0) {
-            if (strlen(settings.default_path)) {
-                sprintf(
-                    settings.paths[i].path,
-                    "%.*s",
-                    (int)sizeof(settings.paths[i].path),
-                    settings.default_path
-                );
+    messageRespond(
+        "Texture cache: %.1f / %.1f MiB\n",
+        settings.vram_used / 1048576.0,
+        settings.vram_budget / 1048576.0
+    );
 
-                len = strlen(settings.default_path);
-            } else {
-                fprintf(
-                    stderr,
-                    "Tried to set default path but none was specified!\n"
-                );
-                settings.running = false;
-                return 0;
-            }
+    struct rusage usage;
+    long pages = 0;
+    FILE *statm = fopen("/proc/self/statm", "r");
+
+    if (statm != NULL) {
+        if (fscanf(statm, "%*d %ld", &pages) != 1) {
+            pages = 0;
         }
 
-        outputPtr("Monitor %d path: %s\n", i, settings.paths[i].path);
+        fclose(statm);
+    }
 
-        if (settings.paths[i].path[len - 1] != '/') {
-            sprintf(
-                settings.paths[i].path + len,
-                "%.*s",
-                (int)sizeof(settings.paths[i].path) - len,
-                "/"
-            );
+    getrusage(RUSAGE_SELF, &usage);
 
-            len = strlen(settings.paths[i].path);
-        }
+    messageRespond(
+        "Memory: %.1f MiB, peak %.1f MiB, limit %.1f MiB\n",
+        pages * sysconf(_SC_PAGESIZE) / 1048576.0,
+        usage.ru_maxrss / 1024.0,
+        settings.memory / 1048576.0
+    );
 
-        sprintf(
-            settings.paths[i].path + len,
-            "%.*s",
-            (int)sizeof(settings.paths[i].path) - len,
-            "*.{jpg,png}"
+    messageRespond(
+        "Objects: %d GL textures, %d file descriptors\n",
+        settings.textures,
+        countDescriptors()
+    );
+
+    messageRespond(
+        "Timing: started in %.2f s, fade waited %.3f s (max %.3f s, %d fades)\n",
+        settings.startup,
+        settings.transition,
+        settings.transition_max,
+        settings.transitions
+    );
+
+    if (settings.decoder != NULL) {
+        messageRespond("Decoders: %d\n", settings.decoder->nthreads);
+    }
+
+    if (settings.shared != NULL) {
+        uint64_t top = atomic_load(&settings.shared->top);
+
+        messageRespond(
+            "Shared cache: %.1f / %.1f MiB\n",
+            (top < settings.shared->size ? top : settings.shared->size) /
+            1048576.0,
+            settings.shared->size / 1048576.0
         );
     }
 
-    return 1;
+    #ifdef GraphicsMagick
+    messageRespond(
+        "Magick: %.1f MiB heap, %.1f MiB mapped\n",
+        GetMagickResource(MemoryResource) / 1048576.0,
+        GetMagickResource(MapResource) / 1048576.0
+    );
+    #else
+    messageRespond(
+        "Magick: %.1f MiB heap, %.1f MiB mapped\n",
+        MagickGetResource(MemoryResource) / 1048576.0,
+        MagickGetResource(MapResource) / 1048576.0
+    );
+    #endif
 }
 
-void help(const char *filename)
+void limitMemory()
 {
-    printf("Usage: %s [options]\n", filename);
-    printf("    -f, fade    : fade time (default 1.0s)\n");
-    printf("    -i, idle    : idle time (default 3s)\n");
-    printf("    -s, smooth  : smoothing function to use when fading.\n");
-    printf("                    1: linear\n");
-    printf("                    2: smoothstep (default)\n");
-    printf("                    3: smootherstep\n");
-    printf("\n");
-    printf("    -p, paths   : wallpapers paths.\n");
-    printf("                    use monitor:path, if no monitor is\n");
-    printf("                    specified the path will be used as\n");
-    printf("                    the default path\n");
-    printf("\n");
-    printf("                    example: -p 0:path,1:path,path\n");
-    printf("\n");
-    printf("    -l, lower   : finds and lowers window by classname (e.g. Conky)\n");
-    printf("    -c, center  : center wallpapers\n");
-    printf("    -m, message : send message to running process (-m help)\n");
-    printf("    -h, help    : help\n");
-    printf("\n");
+    if (settings.threads > 0) {
+        #ifdef GraphicsMagick
+        SetMagickResourceLimit(ThreadsResource, settings.threads);
+        #else
+        MagickSetResourceLimit(ThreadResource, settings.threads);
+        #endif
+
+        #ifdef _OPENMP
+        omp_set_num_threads(settings.threads);
+        #endif
+    }
+
+    if (settings.memory == 0) {
+        return;
+    }
+
+    // Pixel caches beyond the limits spill to disk instead of growing RSS.
+    // GraphicsMagick's PixelsResource would instead refuse larger images
+    // outright, so it is left alone.
+    #ifdef GraphicsMagick
+    SetMagickResourceLimit(MemoryResource, settings.memory / 2);
+    SetMagickResourceLimit(MapResource, settings.memory / 2);
+    #else
+    MagickSetResourceLimit(MemoryResource, settings.memory / 2);
+    MagickSetResourceLimit(MapResource, settings.memory / 2);
+    MagickSetResourceLimit(AreaResource, settings.memory / 8);
+    #endif
+
+    // Every thread that mallocs would otherwise get an arena of its own, and
+    // a fixed threshold keeps pixel buffers in mmap so free returns them.
+    mallopt(M_ARENA_MAX, 2);
+    mallopt(M_MMAP_THRESHOLD, 128 * 1024);
 }
 
-int getProcIdByName(const char *proc_name)
+void trimMemory()
 {
-    int pid = -1;
-    int current = getpid();
+    if (settings.memory != 0) {
+        malloc_trim(0);
+    }
+}
 
-    DIR *proc = opendir("/proc");
+bool parseGeometry(const char *geometry)
+{
+    int x = 0;
 
-    if (proc != NULL) {
-        struct dirent *ent;
+    settings.nmon = 0;
 
-        while (pid < 0 && (ent = readdir(proc))) {
-            int id = atoi(ent->d_name);
+    // Headless monitors are laid out left to right, like a span wall.
+    while (*geometry != '\0') {
+        settings.planes = realloc(
+                              settings.planes,
+                              (settings.nmon + 1) * sizeof(struct Plane)
+                          );
+        settings.nfiles = realloc(
+                              settings.nfiles,
+                              (settings.nmon + 1) * sizeof(int)
+                          );
 
-            if (id > 0 && id != current) {
-                char path[PATH_MAX] = {0};
-                sprintf(path, "/proc/%s/stat", ent->d_name);
+        struct Plane *plane = &settings.planes[settings.nmon];
+        int len = 0;
 
-                FILE *f = fopen(path, "r");
+        memset(plane, 0, sizeof(struct Plane));
+        settings.nfiles[settings.nmon] = 0;
 
-                if (f == NULL) {
-                    continue;
-                }
+        if (
+            sscanf(geometry, "%dx%d%n", &plane->width, &plane->height, &len) != 2 ||
+            plane->width <= 0 ||
+            plane->height <= 0
+        ) {
+            fprintf(stderr, "Invalid geometry %s\n", geometry);
+            return false;
+        }
 
-                char name[PATH_MAX];
+        plane->x = x;
+        x += plane->width;
 
-                int ret = fscanf(f, "%*d (%" S(PATH_MAX) "[^)]", name);
+        printf(
+            "monitor: %d %dx%d+%d+%d\n",
+            settings.nmon,
+            plane->width,
+            plane->height,
+            plane->x,
+            plane->y
+        );
 
-                if (ret > 0 && !strcmp(name, proc_name)) {
-                    pid = id;
-                    break;
-                }
+        settings.nmon++;
+        geometry += len;
 
-                fclose(f);
-            }
+        if (*geometry == ',') {
+            geometry++;
         }
     }
 
-    closedir(proc);
+    growMonitors(settings.nmon);
 
-    return pid;
+    return settings.nmon > 0;
 }
 
-const char *getHomeDir()
+int precacheImage(struct Precache *job)
 {
-    const char *homedir = getenv("HOME");
+    char file[PATH_MAX];
 
-    if (homedir != 0) {
-        return homedir;
+    if (!diskPath(job->path, job->width, job->height, file)) {
+        return -1;
     }
 
-    struct passwd *result = getpwuid(getuid());
+    if (fileExists(file)) {
+        return 1;
+    }
 
-    if (result == 0) {
-        fprintf(stderr, "Unable to find home-directory\n");
-        exit(EXIT_FAILURE);
+    // Skip anything Magick cannot even identify before decoding it.
+    if (!validImage(job->path)) {
+        return -1;
     }
 
-    homedir = result->pw_dir;
+    unsigned char *data = loadPixels(job->path, job->width, job->height);
+    bool ok = data != NULL &&
+              diskWrite(job->path, job->width, job->height, data);
 
-    return homedir;
-}
+    free(data);
+    trimMemory();
 
-bool fileExists(const char *name)
-{
-    struct stat buffer;
-    return (stat(name, &buffer) == 0);
+    return ok ? 0 : -1;
 }
 
-void loadConfig()
+int precacheImages(char *paths, const char *geometry)
 {
-    dictionary *ini = 0;
-    char filename[PATH_MAX] = {0};
-    char file[255] = {"/wallfade.ini"};
-
-    const char *confdir = getenv("XDG_CONFIG_HOME");
+    char dir[PATH_MAX];
 
-    if (confdir == 0) {
-        sprintf(file, "/.wallfade.ini");
-        confdir = getHomeDir();
+    if (geometry[0] != '\0') {
+        if (!parseGeometry(geometry)) {
+            return 0;
+        }
     } else {
-        sprintf(filename, "%s%s", confdir, file);
+        settings.dpy = XOpenDisplay(NULL);
 
-        if (!fileExists(filename)) {
-            sprintf(file, "/.wallfade.ini");
-            confdir = getHomeDir();
+        if (settings.dpy == NULL) {
+            fprintf(stderr, "Cannot connect to X server, use --geometry\n");
+            return 0;
         }
-    }
 
-    sprintf(filename, "%s%s", confdir, file);
+        settings.root = DefaultRootWindow(settings.dpy);
 
-    if (!fileExists(filename)) {
-        sprintf(filename, "./wallfade.ini"); // Useful when debugging
+        // Same screens as the daemon would drive, without windows.
+        int count = settings.screens && !settings.span ?
+                    ScreenCount(settings.dpy) : 1;
+
+        settings.heads = calloc(count, sizeof(struct Head));
+        settings.nheads = count;
+
+        for (int i = 0; i < count; i++) {
+            int screen = count > 1 ? i : DefaultScreen(settings.dpy);
+
+            settings.heads[i].screen = screen;
+            settings.heads[i].root = RootWindow(settings.dpy, screen);
+        }
+
+        if (!getMonitorsXRR() && !getMonitorsXinerama()) {
+            fprintf(stderr, "Unable to find monitors\n");
+            return 0;
+        }
     }
 
-    if (fileExists(filename)) {
-        ini = iniparser_load(filename);
+    if (!parsePaths(paths, printf) || !getCacheDir(dir, true)) {
+        return 0;
     }
 
-    settings.smoothfunction = iniparser_getint(ini, "settings:smooth", 2);
-    settings.idle = iniparser_getint(ini, "settings:idle", DEFAULT_IDLE_TIME);
-    settings.fade = iniparser_getdouble(ini, "settings:fade", DEFAULT_FADE_TIME);
-    settings.fade = 1.0f / settings.fade;
-    settings.center = iniparser_getboolean(ini, "settings:center", false);
-    strcpy(settings.lower, iniparser_getstring(ini, "settings:lower", "\0"));
+    #ifdef GraphicsMagick
+    InitializeMagick(NULL);
+    #else
+    MagickWandGenesis();
+    #endif
 
-    strcpy(
-        settings.default_path,
-        iniparser_getstring(ini, "paths:default", "\0")
-    );
+    limitMemory();
+
+    if (settings.span) {
+        spanLayout();
+    }
 
-    settings.paths = malloc(MAX_MONITORS * sizeof(struct Path));
+    struct Precache *jobs = NULL;
+    int njobs = 0;
+    int nmon = settings.span ? 1 : settings.nmon;
 
-    for (int i = 0; i < MAX_MONITORS; i += 1) {
-        char monitor[256] = {0};
-        sprintf(monitor, "paths:monitor%d", i);
-        strcpy(settings.paths[i].path, iniparser_getstring(ini, monitor, "\0"));
+    for (int i = 0; i < nmon; i++) {
+        int width = settings.span ? settings.span_width : settings.planes[i].width;
+        int height = settings.span ? settings.span_height : settings.planes[i].height;
+        bool seen = false;
 
-        if (strlen(settings.default_path) == 0) {
-            strcpy(settings.default_path, settings.paths[i].path);
+        for (int j = 0; j < i; j++) {
+            seen |= (
+                        settings.planes[j].width == width &&
+                        settings.planes[j].height == height &&
+                        !strcmp(settings.paths[j].path, settings.paths[i].path)
+                    );
         }
-        char mirror[256] = {0};
-        sprintf(mirror, "mirror:monitor%d", i);
-        settings.mirror[i] = iniparser_getboolean(ini, mirror, 0);
-    }
 
-    iniparser_freedict(ini);
-}
+        if (seen) {
+            continue;
+        }
 
-void printConfig()
-{
-    messageRespond("[SETTINGS]\n");
-    messageRespond("smooth = %i\n", settings.smoothfunction);
-    messageRespond("idle = %i\n", settings.idle);
-    messageRespond("fade = %f\n", 1.0f / settings.fade);
-    messageRespond("center = %s\n", settings.center ? "TRUE" : "FALSE");
+        struct Index *index = getFiles(i);
 
-    if (settings.lower[0] != 0) {
-        messageRespond("lower = %s\n", settings.lower);
+        jobs = realloc(jobs, (njobs + index->nfiles) * sizeof(struct Precache));
+
+        for (int j = 0; j < index->nfiles; j++) {
+            jobs[njobs].path = index->entries[j].path;
+            jobs[njobs].width = width;
+            jobs[njobs].height = height;
+            njobs++;
+        }
     }
 
-    messageRespond("\n[PATHS]\n");
+    printf("Precaching %d images into %s\n", njobs, dir);
 
-    if (settings.default_path[0] != 0) {
-        char *dironly = strdup(settings.default_path);
-        dironly = dirname(dironly);
-        messageRespond("default = \"%s\"\n", dironly);
-        free(dironly);
-    }
+    struct timespec start;
+    struct timespec last;
+    int done = 0;
+    int cached = 0;
+    int fresh = 0;
+    int failed = 0;
 
-    for (int i = 0; i < MAX_MONITORS; i++) {
-        if (settings.paths[i].path[0] != 0) {
-            char *dironly = strdup(settings.paths[i].path);
-            dironly = dirname(dironly);
-            messageRespond("monitor%i = \"%s\"\n", i, dironly);
-            free(dironly);
-        }
-    }
-    messageRespond("\n[MIRROR]\n");
-    for(int i = 0; i < MAX_MONITORS; i++) {
-        messageRespond("monitor%i = %s\n",i , settings.mirror[i] ? "TRUE" : "FALSE");
-    }
-}
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    last = start;
 
-char *createSharedMemory(size_t size, int parent)
-{
-    int shmid = shmget(parent, size, IPC_CREAT | S_IRUSR | S_IWUSR);
-    return shmat(shmid, 0, 0);
-}
+    #pragma omp parallel for schedule(dynamic)
+    for (int i = 0; i < njobs; i++) {
+        int status = precacheImage(&jobs[i]);
 
-int main(int argc, char *argv[])
-{
-    int c;
+        #pragma omp critical
+        {
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
 
-    settings.parent = getProcIdByName("wallfade");
+            done++;
+            cached += status == 0;
+            fresh += status == 1;
 
-    if (settings.parent == -1) {
-        struct timespec ts;
+            if (status < 0) {
+                failed++;
+                fprintf(stderr, "Unable to precache %s\n", jobs[i].path);
+            }
 
-        if (timespec_get(&ts, TIME_UTC) == 0) {
-            fprintf(stderr, "Unable to get time for random!\n");
-            return EXIT_FAILURE;
+            double elapsed = (now.tv_sec - start.tv_sec) +
+                             (now.tv_nsec - start.tv_nsec) / 1e9;
+
+            if (now.tv_sec != last.tv_sec || done == njobs) {
+                printf(
+                    "%d/%d images, %.1f images/s\n",
+                    done,
+                    njobs,
+                    elapsed > 0 ? cached / elapsed : 0.0
+                );
+                fflush(stdout);
+
+                last = now;
+            }
         }
+    }
+
+    printf(
+        "Precached %d images, %d up to date, %d failed\n",
+        cached,
+        fresh,
+        failed
+    );
+
+    free(jobs);
 
-        srandom(ts.tv_nsec ^ ts.tv_sec);
+    for (int i = 0; settings.index && i < settings.nmon; i++) {
+        cleanFiles(&settings.index[i]);
+    }
 
-        signal(SIGINT, gotsig);
-        signal(SIGKILL, gotsig);
-        signal(SIGTERM, gotsig);
-        signal(SIGQUIT, gotsig);
+    #ifdef GraphicsMagick
+    DestroyMagick();
+    #else
+    MagickWandTerminus();
+    #endif
 
-        settings.shmem = createSharedMemory(MEM_SIZE, getpid());
-        memset(settings.shmem, 0, MEM_SIZE);
+    return failed == 0;
+}
 
-        memset(settings.default_path, 0, PATH_MAX);
-        memset(settings.lower, 0, PATH_MAX);
+int main(int argc, char *argv[])
+{
+    int c;
+    struct timespec ts;
 
-        settings.timer = 0;
-        settings.running = true;
-        settings.fading = false;
-        settings.planes = NULL;
+    clock_gettime(CLOCK_MONOTONIC, &settings.started);
+    settings.lock = -1;
 
-        loadConfig();
+    if (timespec_get(&ts, TIME_UTC) == 0) {
+        fprintf(stderr, "Unable to get time for random!\n");
+        return EXIT_FAILURE;
     }
 
+    srandom(ts.tv_nsec ^ ts.tv_sec);
+
+    signal(SIGINT, gotsig);
+    signal(SIGKILL, gotsig);
+    signal(SIGTERM, gotsig);
+    signal(SIGQUIT, gotsig);
+
+    settings.epoll = -1;
+    settings.server = -1;
+    settings.inotify = -1;
+    settings.shared_fd = -1;
+    settings.paths = NULL;
+    settings.mirror = NULL;
+    settings.fps = NULL;
+    settings.npaths = 0;
+    settings.clients = NULL;
+    settings.client = NULL;
+    settings.closed = NULL;
+
+    memset(settings.default_path, 0, PATH_MAX);
+    memset(settings.lower, 0, PATH_MAX);
+
+    settings.timer = 0;
+    settings.running = true;
+    settings.fading = false;
+    settings.obscured = false;
+    settings.covered = false;
+    settings.blanked = false;
+    settings.power_changed = true;
+    settings.suspended = false;
+    settings.planes = NULL;
+    settings.index = NULL;
+    settings.playlists = NULL;
+    settings.snapshots = NULL;
+    settings.snapshotting = false;
+    settings.overrides = 0;
+
+    loadConfig();
+
     static const struct option longOpts[] = {
         { "lower", required_argument, 0, 'l' },
         { "center", required_argument, 0, 'c' },
+        { "span", no_argument, 0, 'S' },
+        { "bezel", required_argument, 0, 'b' },
         { "paths", required_argument, 0, 'p' },
         { "smooth", required_argument, 0, 's' },
         { "fade", required_argument, 0, 'f' },
         { "idle", required_argument, 0, 'i' },
         { "message", required_argument, 0, 'm' },
         { "mirror", required_argument, 0, 'M' },
+        { "order", required_argument, 0, 'o' },
+        { "precache", no_argument, 0, 'P' },
+        { "geometry", required_argument, 0, 'g' },
         { "help", no_argument, 0, 'h' },
         { 0, 0, 0, 0 }
     };
 
     int longIndex = 0;
-    char paths[PATH_MAX * MAX_MONITORS] = {0};
-    char mirrors[PATH_MAX * MAX_MONITORS] = {0};
+    char *paths = strdup("");
+    char *mirrors = strdup("");
+    char geometry[PATH_MAX] = {0};
+    bool precache = false;
 
     while ((c = getopt_long(
                     argc,
                     argv,
-                    "o:p:f:i:hcs:l:m:M:",
+                    "o:p:f:i:hcSb:s:l:m:M:Pg:",
                     longOpts,
                     &longIndex
                 )) != -1) {
         switch (c) {
             case 'f':
                 settings.fade = 1.0f / strtof(optarg, NULL);
+                settings.overrides |= OVERRIDE_FADE;
                 break;
 
             case 'i':
                 settings.idle = strtol(optarg, NULL, 10);
+                settings.overrides |= OVERRIDE_IDLE;
                 break;
 
             case 'l':
                 sprintf(settings.lower, "%.*s", PATH_MAX - 1, optarg);
+                settings.overrides |= OVERRIDE_LOWER;
                 break;
 
             case 'c':
                 settings.center = true;
+                settings.overrides |= OVERRIDE_CENTER;
                 break;
 
-            case 's':
-                settings.smoothfunction = strtol(optarg, NULL, 10);
+            case 'S':
+                settings.span = true;
+                settings.overrides |= OVERRIDE_SPAN;
                 break;
 
-            case 'p':
-                sprintf(paths, "%.*s", (PATH_MAX * MAX_MONITORS) - 1, optarg);
+            case 'b':
+                settings.bezel = strtol(optarg, NULL, 10);
+                settings.overrides |= OVERRIDE_BEZEL;
                 break;
 
-            case 'M':
-                sprintf(mirrors, "%.*s", (PATH_MAX * MAX_MONITORS) - 1, optarg);
+            case 's':
+                settings.smoothfunction = strtol(optarg, NULL, 10);
+                settings.overrides |= OVERRIDE_SMOOTH;
                 break;
 
-            case 'm':
-                if (settings.parent != -1) {
-                    settings.shmem = createSharedMemory(
-                                         MEM_SIZE,
-                                         settings.parent
-                                     );
+            case 'p':
+                free(paths);
+                paths = strdup(optarg);
+                settings.overrides |= OVERRIDE_PATHS;
+                break;
 
-                    while (settings.shmem[0] != MSG_NONE) {
-                        usleep(10000);
-                    }
+            case 'o':
+                settings.order = parseOrder(optarg);
+                settings.overrides |= OVERRIDE_ORDER;
 
-                    sprintf(settings.shmem, "%.*s", MEM_SIZE, optarg);
+                if (settings.order < 0) {
+                    fprintf(stderr, "Unknown order %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
 
-                    while (settings.shmem[0] != MSG_DONE) {
-                        if (settings.shmem[0] == MSG_PARENT) {
-                            printf("%s", &settings.shmem[1]);
-                            settings.shmem[0] = MSG_NONE;
-                        }
+                break;
 
-                        usleep(10000);
-                    }
+            case 'M':
+                free(mirrors);
+                mirrors = strdup(optarg);
+                settings.overrides |= OVERRIDE_MIRROR;
+                break;
 
-                    printf("%s", &settings.shmem[1]);
-                    settings.shmem[0] = MSG_NONE;
+            case 'P':
+                precache = true;
+                break;
 
-                    shmdt(&settings.shmem);
-                } else {
-                    fprintf(stderr, "No wallfade process found!\n");
-                    return EXIT_FAILURE;
-                }
+            case 'g':
+                sprintf(geometry, "%.*s", PATH_MAX - 1, optarg);
+                break;
 
-                return EXIT_SUCCESS;
+            case 'm':
+                return sendMessage(optarg);
 
             case 'h':
                 help(argv[0]);
@@ -1558,7 +8519,21 @@ int main(int argc, char *argv[])
         }
     }
 
-    if (settings.parent != -1) {
+    // Precaching only writes whole files through rename, it can run next
+    // to the daemon and must not keep one from starting.
+    if (precache) {
+        bool ok = precacheImages(paths, geometry);
+
+        free(paths);
+        free(mirrors);
+
+        return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    // Only the daemon holds the instance lock, -m clients just connect.
+    settings.lock = lockInstance();
+
+    if (settings.lock < 0) {
         fprintf(stderr, "Another wallfade processes is already running!\n");
         return EXIT_FAILURE;
     }
@@ -1569,21 +8544,44 @@ int main(int argc, char *argv[])
 
         return EXIT_FAILURE;
     } else {
+        if (!startServer()) {
+            stopServer();
+            return EXIT_FAILURE;
+        }
+
+        if (!watchConfig()) {
+            fprintf(stderr, "Unable to watch %s\n", settings.config_path);
+        }
+
         if (init(argc, argv)) {
             parseMirrors(mirrors);
+            loadSnapshots();
+
             if (parsePaths(paths, printf)) {
-                for (int i = 0; i < settings.nmon; i++) {
-                    randomImages(i);
+                if (settings.span) {
+                    spanLayout();
+                    randomSpan();
+                } else {
+                    for (int i = 0; i < settings.nmon; i++) {
+                        randomImages(i);
+                    }
                 }
 
+                settings.warm = false;
+
                 while (settings.running) {
                     update();
                 }
             }
 
-            shutdown();
+            cleanup();
+        } else {
+            stopServer();
         }
     }
 
+    free(paths);
+    free(mirrors);
+
     return EXIT_SUCCESS;
 }